@@ -0,0 +1,91 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utils-cpp/circularbuffer.h>
+#include <utils-cpp/default_ctor_ops.h>
+
+struct BlockingCircularBufferOptions
+{
+    // Writer blocked on full buffer is woken only when at least this much space is free
+    // (or enough for the rest of its data). 0 - quarter of capacity.
+    size_t writeWakeupThreshold { 0 };
+};
+
+
+// Bounded thread-safe byte channel, like a pipe: writers block while it's full, readers block while
+// there is not enough data. Waiters are woken only when their condition is met, not on every operation.
+// After `close` writes fail and readers get the rest of data, then EOF (0 bytes).
+class BlockingCircularBuffer
+{
+public:
+    NO_COPY_MOVE(BlockingCircularBuffer);
+
+    // `capacity` must be above 0
+    BlockingCircularBuffer(size_t capacity, const BlockingCircularBufferOptions& options = {});
+    ~BlockingCircularBuffer();
+
+    size_t size() const;
+    size_t capacity() const { return m_capacity; }
+
+    // Non-blocking, same as CircularBuffer. `tryWrite` returns 0 if closed.
+    size_t tryWrite(const void* data, size_t bytes);
+    size_t tryRead(void* data, size_t bytes);
+
+    // Block until all `bytes` are written. Return number of written bytes,
+    // less than `bytes` if closed or timed out.
+    size_t writeAll(const void* data, size_t bytes) { return writeImpl(data, bytes, nullptr); }
+
+    template<typename Rep, typename Period>
+    size_t writeAllFor(const void* data, size_t bytes, const std::chrono::duration<Rep, Period>& timeout) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(timeout);
+        return writeImpl(data, bytes, &deadline);
+    }
+
+    // Block until at least `minBytes` (limited by capacity) are available, then read up to `maxBytes`.
+    // Closed buffer or timeout: return what's available, 0 is EOF (closed and empty) or timeout without data.
+    // `maxBytes` 0 returns 0 at once.
+    size_t readAtLeast(void* data, size_t minBytes, size_t maxBytes) { return readImpl(data, minBytes, maxBytes, nullptr); }
+
+    template<typename Rep, typename Period>
+    size_t readAtLeastFor(void* data, size_t minBytes, size_t maxBytes, const std::chrono::duration<Rep, Period>& timeout) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(timeout);
+        return readImpl(data, minBytes, maxBytes, &deadline);
+    }
+
+    void close();
+    bool isClosed() const;
+
+private:
+    size_t writeImpl(const void* data, size_t bytes, const std::chrono::steady_clock::time_point* deadline);
+    size_t readImpl(void* data, size_t minBytes, size_t maxBytes, const std::chrono::steady_clock::time_point* deadline);
+
+    template<typename Predicate>
+    bool wait(std::unique_lock<std::mutex>& lock, std::condition_variable& cv,
+              const std::chrono::steady_clock::time_point* deadline, Predicate predicate);
+
+    void notifyReaders();
+    void notifyWriters();
+
+private:
+    const size_t m_capacity;
+    const size_t m_writeWakeupThreshold;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_readersCv;
+    std::condition_variable m_writersCv;
+    CircularBuffer m_buffer;
+    bool m_closed { false };
+
+    // Smallest requirement of waiting readers (data size) / writers (free space), so that
+    // the other side notifies only when it's met. Reset when nobody waits.
+    size_t m_readersWaiting { 0 };
+    size_t m_writersWaiting { 0 };
+    size_t m_readersWanted { 0 };
+    size_t m_writersWanted { 0 };
+};
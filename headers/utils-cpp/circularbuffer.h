@@ -3,13 +3,66 @@
  * Contact:  ihor-drachuk-libs@pm.me  */
 
 #pragma once
+#include <array>
 #include <cstddef>
+#include <functional>
+#include <optional>
 #include <tuple>
 
+struct CircularBufferOptions
+{
+    // Linux only: storage pages are mapped twice back to back, so data and free space are always
+    // contiguous (`readableSpans` / `writableSpans` return a single region, no split records).
+    // Capacity is rounded up to page size. Ignored where unsupported, see `CircularBuffer::isMirrored`.
+    bool mirrored { false };
+
+    // `write` and `fill` never truncate: when free space runs out, the oldest bytes are discarded
+    // to make room (see `CircularBuffer::droppedBytes`) and the whole input is reported as written.
+    // Only the last `capacity` bytes of a larger write are kept.
+    bool overwrite { false };
+
+    // Growable mode: if `write` / `fill` doesn't fit, storage is reallocated to twice the capacity
+    // (at least to fit the data), up to `maxCapacity`. Contents are unwrapped during reallocation.
+    // 0 or not above initial capacity - fixed size.
+    size_t maxCapacity { 0 };
+
+    // Growable mode: capacity is halved (not below initial one) once occupancy stays
+    // at or below 1/4 for this many reads / consumes in a row. 0 - never shrink.
+    size_t shrinkAfterReads { 0 };
+
+    // Storage policy. Used for the ordinary (not mirrored) storage, except for `lock`.
+    //  - alignment: power of two, 0 - default of `new[]`. Mapped storage is page aligned anyway.
+    //  - hugePages: Linux only. `Explicit` maps MAP_HUGETLB pages (size is rounded to 2 MiB, needs reserved
+    //    huge pages), `Transparent` maps regular pages with MADV_HUGEPAGE. Fallback chain: `Explicit` falls
+    //    back to `Transparent` if there are no reserved huge pages, and if mapping fails at all, storage is
+    //    allocated as without `hugePages` (`new[]`, aligned if `alignment` is set).
+    //  - lock: mlock storage (POSIX), best effort, see `CircularBuffer::isLocked`.
+    //  - allocate / deallocate: user allocator, takes precedence over `alignment` and `hugePages`.
+    enum class HugePages { None, Transparent, Explicit };
+
+    size_t alignment { 0 };
+    HugePages hugePages { HugePages::None };
+    bool lock { false };
+    std::function<void*(size_t size)> allocate;
+    std::function<void(void* data, size_t size)> deallocate;
+};
+
+
 class CircularBuffer
 {
 public:
+    template<typename T>
+    struct SpanT
+    {
+        T* data {};
+        size_t size {};
+    };
+
+    using Span = SpanT<unsigned char>;
+    using ConstSpan = SpanT<const unsigned char>;
+
     CircularBuffer(size_t capacity);
+    CircularBuffer(size_t capacity, const CircularBufferOptions& options);
     CircularBuffer(const CircularBuffer& rhs);
     CircularBuffer(CircularBuffer&& rhs) noexcept;
     ~CircularBuffer();
@@ -19,22 +72,70 @@ public:
 
     size_t size() const { return m_size; }
     size_t capacity() const { return m_capacity; }
+    const CircularBufferOptions& options() const { return m_options; }
+    bool isMirrored() const { return m_mirrored; }
+    bool isLocked() const { return m_locked; }
+    size_t droppedBytes() const { return m_droppedBytes; } // Discarded in overwrite mode, not cleared by `reset`
     size_t write(const void* data, size_t bytes);
     size_t fill(unsigned char byte, size_t size);
     size_t read(void* data, size_t bytes, bool erase = true);
     size_t readRO(void* data, size_t bytes) const;
     void reset();
 
+    // Zero-copy access. Data (free space) is split into up to two contiguous regions
+    // because of the wrap, the second one is empty if there is no wrap.
+    // `consume` drops `bytes` from the beginning of readable data,
+    // `commit` appends `bytes` written into the beginning of writable regions.
+    std::array<ConstSpan, 2> readableSpans() const;
+    std::array<Span, 2> writableSpans();
+    void consume(size_t bytes);
+    void commit(size_t bytes);
+
+    // Search data in place, starting `from` bytes after the read head.
+    // Return offset from the read head. Pattern may straddle the wrap point.
+    std::optional<size_t> find(unsigned char byte, size_t from = 0) const;
+    std::optional<size_t> find(const void* pattern, size_t size, size_t from = 0) const;
+
+#ifndef UTILS_CPP_OS_WINDOWS
+    // Direct I/O between file descriptor and storage with a single readv/writev over the spans.
+    // Transfer up to `max` bytes (limited by free space / data size), `max` must be positive.
+    // Return number of bytes transferred or -1 on error (see errno). EINTR is retried, EAGAIN is reported as error.
+    // readFromFd: 0 is EOF only. Full buffer is an error with errno ENOBUFS, growable buffer grows first.
+    // writeToFd: 0 if buffer is empty.
+    ptrdiff_t readFromFd(int fd, size_t max = static_cast<size_t>(-1));
+    ptrdiff_t writeToFd(int fd, size_t max = static_cast<size_t>(-1));
+#endif // UTILS_CPP_OS_WINDOWS
+
 private:
     template<typename A, typename B>
     inline static A min(A a, B b) {
         return (a < b) ? a : b;
     }
 
-    auto tie() { return std::tie(m_begIndex, m_endIndex, m_size, m_capacity, m_data, m_moved); }
+    bool equalsAt(size_t offset, const unsigned char* pattern, size_t size) const;
+    size_t makeRoom(size_t bytes);
+    void growFor(size_t bytes);
+    void shrinkIfIdle();
+    void reallocate(size_t capacity);
+    void allocate(size_t capacity);
+    void deallocate();
+    void swapStorage(CircularBuffer& other);
+
+    // Everything but `m_options`, which is moved separately (holds std::function's)
+    auto tie() { return std::tie(m_begIndex, m_endIndex, m_size, m_capacity, m_data, m_moved, m_mirrored, m_droppedBytes, m_initialCapacity, m_lowReads, m_storage, m_mappedSize, m_locked); }
 
 private:
     size_t m_begIndex, m_endIndex, m_size, m_capacity;
     unsigned char* m_data;
     bool m_moved { false };
+    CircularBufferOptions m_options;
+    bool m_mirrored { false };
+    size_t m_droppedBytes { 0 };
+    size_t m_initialCapacity { 0 };
+    size_t m_lowReads { 0 };
+
+    enum class Storage { Heap, AlignedHeap, User, Mapped, Mirrored };
+    Storage m_storage { Storage::Heap };
+    size_t m_mappedSize { 0 };
+    bool m_locked { false };
 };
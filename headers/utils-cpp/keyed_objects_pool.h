@@ -0,0 +1,379 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+#pragma once
+#include <utils-cpp/objects_pool.h>
+#include <utils-cpp/default_ctor_ops.h>
+#include <utils-cpp/scoped_guard.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct KeyedObjectsPoolOptions
+{
+    // Cap on objects of all keys, 0 - unlimited.
+    // When it's reached, free objects of the least recently used keys are destroyed to make room.
+    size_t maxTotal { 0 };
+
+    // Default per-key limits, see `KeyedObjectsPool::setKeyLimits`. `maxPerKey` 0 - only global cap.
+    size_t minPerKey { 0 };
+    size_t maxPerKey { 0 };
+
+    // Free objects of keys which weren't used during this period are destroyed (down to per-key minimum).
+    // Checked by takers, so it needs no extra thread. 0 - objects are destroyed only to fit `maxTotal`.
+    std::chrono::milliseconds idleTimeout { 0 };
+};
+
+
+// Set of elastic ObjectsPool's, one per key, sharing one object budget.
+// Objects are created on demand by `factory(key)`; the factory may return nullptr to refuse.
+// Taking by key looks it up in the map of keys under a shared lock, taking through `Handle` doesn't.
+// Takers blocked by the limit of their key wait in FIFO queue of its sub-pool,
+// takers blocked by the global cap are woken whenever an object of any key is returned.
+template<typename Key, typename T, typename Hash = std::hash<Key>>
+class KeyedObjectsPool
+{
+    struct Entry;
+
+public:
+    using Factory = std::function<std::unique_ptr<T>(const Key&)>;
+
+    // Key resolved to its sub-pool. Operations with a handle skip the keys map and its lock,
+    // so hot paths should keep one per key. Usable only with the pool which issued it.
+    class Handle
+    {
+    public:
+        Handle() = default;
+
+        bool isValid() const { return !!m_entry; }
+        const Key& key() const { assert(m_entry); return m_entry->key; }
+
+    private:
+        friend class KeyedObjectsPool;
+        explicit Handle(std::shared_ptr<Entry> entry): m_entry(std::move(entry)) {}
+
+        std::shared_ptr<Entry> m_entry;
+    };
+
+    NO_COPY(KeyedObjectsPool);
+
+    KeyedObjectsPool(const KeyedObjectsPoolOptions& options, const Factory& factory)
+        : m_options(options),
+          m_factory(factory),
+          m_shared(std::make_shared<Shared>())
+    {
+        assert(m_factory);
+        assert(!m_options.maxPerKey || m_options.minPerKey <= m_options.maxPerKey);
+    }
+
+    // Pools of keys outlive this object while their objects are taken
+    ~KeyedObjectsPool() = default;
+
+    // Overrides default limits for `key`. Must be called before the key is used.
+    void setKeyLimits(const Key& key, size_t minSize, size_t maxSize) {
+        assert(!maxSize || minSize <= maxSize);
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        assert(m_entries.find(key) == m_entries.end() && "Key is already in use");
+        m_limits[key] = {minSize, maxSize};
+    }
+
+    // Creates sub-pool of `key` if it doesn't exist yet
+    Handle handle(const Key& key) { return Handle(acquireEntry(key)); }
+
+    ObjectAccessor<T> take(const Key& key) { return take(handle(key)); }
+    std::optional<ObjectAccessor<T>> tryTake(const Key& key) { return tryTake(handle(key)); }
+
+    template<typename Rep, typename Period>
+    std::optional<ObjectAccessor<T>> takeFor(const Key& key, const std::chrono::duration<Rep, Period>& timeout) {
+        return takeFor(handle(key), timeout);
+    }
+
+    ObjectAccessor<T> take(const Handle& handle) {
+        assert(handle.isValid());
+        return *takeImpl(*handle.m_entry, nullptr);
+    }
+
+    std::optional<ObjectAccessor<T>> tryTake(const Handle& handle) {
+        assert(handle.isValid());
+        evictIdleIfDue();
+        return tryTakeFrom(*handle.m_entry);
+    }
+
+    template<typename Rep, typename Period>
+    std::optional<ObjectAccessor<T>> takeFor(const Handle& handle, const std::chrono::duration<Rep, Period>& timeout) {
+        assert(handle.isValid());
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(timeout);
+        return takeImpl(*handle.m_entry, &deadline);
+    }
+
+    // Destroys free objects of keys not used for `idleFor` (down to per-key minimum).
+    // Returns number of destroyed objects.
+    size_t evictIdle(std::chrono::steady_clock::duration idleFor) {
+        const auto threshold = (std::chrono::steady_clock::now() - idleFor).time_since_epoch().count();
+        size_t result = 0;
+
+        for (const auto& x : snapshot()) {
+            if (x->lastUsed.load(std::memory_order_relaxed) <= threshold)
+                result += trimEntry(*x, (std::numeric_limits<size_t>::max)());
+        }
+
+        return result;
+    }
+
+    size_t size() const { return m_shared->used.load(); } // Objects of all keys, both free and taken
+
+    size_t size(const Key& key) const {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        const auto it = m_entries.find(key);
+        return it == m_entries.end() ? 0 : it->second->pool->size();
+    }
+
+    size_t keys() const {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        return m_entries.size();
+    }
+
+private:
+    // Shared with availability callbacks of sub-pools, which may outlive this object
+    struct Shared
+    {
+        std::atomic<size_t> used { 0 };
+
+        // Takers blocked by the global cap. Returns just read it unless somebody is registered,
+        // then they increment `generation` and wake everybody.
+        alignas(64) std::atomic<int> waiters { 0 };
+        std::atomic<uint64_t> generation { 0 };
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    struct Entry
+    {
+        Entry(const Key& key): key(key) {}
+
+        const Key key;
+        size_t maxSize {};
+        ObjectsPoolPtr<T> pool;
+        std::atomic<int64_t> lastUsed { 0 }; // steady_clock ticks
+    };
+
+    using EntryPtr = std::shared_ptr<Entry>;
+
+    static int64_t nowTicks() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+    std::optional<ObjectAccessor<T>> takeImpl(Entry& entry, const std::chrono::steady_clock::time_point* deadline) {
+        evictIdleIfDue();
+
+        bool registered = false;
+        auto unregister = CreateScopedGuard([this, &registered](){
+            if (registered)
+                m_shared->waiters--;
+        });
+
+        for (;;) {
+            // Read before trying: an object returned after a failed attempt changes it
+            const auto generation = m_shared->generation.load();
+
+            if (auto result = tryTakeFrom(entry))
+                return result;
+
+            // Blocked by own limit: only this key's objects can help, wait for them in sub-pool's queue
+            if (entry.pool->size() >= entry.maxSize) {
+                if (registered) {
+                    m_shared->waiters--;
+                    registered = false;
+                }
+
+                if (deadline)
+                    return entry.pool->takeUntil(*deadline);
+
+                return entry.pool->take();
+            }
+
+            // Blocked by the global cap. Register and try once more: returns following registration change `generation`.
+            if (!registered) {
+                m_shared->waiters++;
+                registered = true;
+                continue;
+            }
+
+            const auto isChanged = [this, generation]() -> bool { return m_shared->generation.load() != generation; };
+            std::unique_lock<std::mutex> lock(m_shared->mutex);
+
+            if (deadline) {
+                m_shared->cv.wait_until(lock, *deadline, isChanged);
+            } else {
+                m_shared->cv.wait(lock, isChanged);
+            }
+
+            if (!isChanged())
+                return {};
+        }
+    }
+
+    std::optional<ObjectAccessor<T>> tryTakeFrom(Entry& entry) {
+        entry.lastUsed.store(nowTicks(), std::memory_order_relaxed);
+        return entry.pool->tryTake();
+    }
+
+    EntryPtr acquireEntry(const Key& key) {
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            const auto it = m_entries.find(key);
+            if (it != m_entries.end())
+                return it->second;
+        }
+
+        // Sub-pool creates its minimum of objects via `createObject`, which may need the lock for eviction
+        auto entry = createEntry(key);
+
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        const auto result = m_entries.emplace(key, entry);
+
+        if (!result.second) {
+            // Lost the race, discard own objects
+            m_shared->used -= entry->pool->size();
+            return result.first->second;
+        }
+
+        return entry;
+    }
+
+    EntryPtr createEntry(const Key& key) {
+        ObjectsPoolOptions options;
+        options.minSize = m_options.minPerKey;
+        options.maxSize = m_options.maxPerKey;
+
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            const auto it = m_limits.find(key);
+
+            if (it != m_limits.end()) {
+                options.minSize = it->second.first;
+                options.maxSize = it->second.second;
+            }
+        }
+
+        if (!options.maxSize)
+            options.maxSize = m_options.maxTotal ? m_options.maxTotal : (std::numeric_limits<size_t>::max)();
+
+        auto entry = std::make_shared<Entry>(key);
+        entry->lastUsed = nowTicks();
+        entry->maxSize = options.maxSize;
+        entry->pool = ObjectsPool<T>::createElastic(options, [this, key]() { return createObject(key); });
+
+        // Called on every return: writes nothing shared unless somebody waits for the global cap.
+        // Free lists of sub-pools are changed by sequentially consistent operations, as `waiters` is:
+        // either the registered taker's retry sees the returned object, or the return sees the taker.
+        entry->pool->setAvailabilityCallback([shared = m_shared]() {
+            if (!shared->waiters.load())
+                return;
+
+            shared->generation++;
+            { std::lock_guard<std::mutex> lock(shared->mutex); }
+            shared->cv.notify_all();
+        });
+
+        return entry;
+    }
+
+    // Factory of sub-pools: reserves a unit of the global budget, evicting cold objects if needed
+    std::unique_ptr<T> createObject(const Key& key) {
+        while (!reserve()) {
+            if (!evictColdest(key))
+                return {};
+        }
+
+        auto result = m_factory(key);
+
+        if (!result)
+            m_shared->used--;
+
+        return result;
+    }
+
+    bool reserve() {
+        auto current = m_shared->used.load();
+
+        do {
+            if (m_options.maxTotal && current >= m_options.maxTotal)
+                return false;
+        } while (!m_shared->used.compare_exchange_weak(current, current + 1));
+
+        return true;
+    }
+
+    // Destroys one free object of the least recently used key other than `except`.
+    // Sub-pools with queued takers are skipped: `trim` leaves objects returned for them alone.
+    bool evictColdest(const Key& except) {
+        // Timestamps change concurrently, order their copies.
+        // Usually the coldest key has a free object, so heap is built in O(K) and rarely popped further.
+        std::vector<std::pair<int64_t, EntryPtr>> entries;
+
+        for (auto& x : snapshot())
+            if (!(x->key == except))
+                entries.emplace_back(x->lastUsed.load(std::memory_order_relaxed), std::move(x));
+
+        const auto isWarmer = [](const auto& a, const auto& b){ return a.first > b.first; };
+        std::make_heap(entries.begin(), entries.end(), isWarmer);
+
+        for (auto end = entries.end(); end != entries.begin(); --end) {
+            std::pop_heap(entries.begin(), end, isWarmer);
+
+            if (trimEntry(*(end - 1)->second, 1))
+                return true;
+        }
+
+        return false;
+    }
+
+    size_t trimEntry(Entry& entry, size_t count) {
+        const auto destroyed = entry.pool->trim(count);
+        m_shared->used -= destroyed;
+        return destroyed;
+    }
+
+    std::vector<EntryPtr> snapshot() const {
+        std::vector<EntryPtr> result;
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        result.reserve(m_entries.size());
+
+        for (const auto& x : m_entries)
+            result.push_back(x.second);
+
+        return result;
+    }
+
+    void evictIdleIfDue() {
+        if (!m_options.idleTimeout.count())
+            return;
+
+        const auto now = nowTicks();
+        const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(m_options.idleTimeout / 4).count();
+        auto last = m_lastIdleCheck.load(std::memory_order_relaxed);
+
+        if (now - last >= period && m_lastIdleCheck.compare_exchange_strong(last, now))
+            evictIdle(m_options.idleTimeout);
+    }
+
+private:
+    const KeyedObjectsPoolOptions m_options;
+    const Factory m_factory;
+    const std::shared_ptr<Shared> m_shared;
+    std::atomic<int64_t> m_lastIdleCheck { 0 };
+
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<Key, EntryPtr, Hash> m_entries;
+    std::unordered_map<Key, std::pair<size_t, size_t>, Hash> m_limits;
+};
@@ -0,0 +1,223 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <utils-cpp/default_ctor_ops.h>
+#include <utils-cpp/scoped_guard.h>
+
+// Bounded lock-free multi-producer/multi-consumer queue of T (D. Vyukov's algorithm).
+// Each slot has a sequence number telling whether it's ready for a producer or a consumer
+// of the current lap, so producers and consumers only contend on their own position counter.
+// Capacity is rounded up to a power of two (at least 2). T may be move-only, but its move constructor
+// must not throw: a claimed slot has to be published, otherwise the ring stalls. Items constructed
+// by a throwing constructor are built before a slot is claimed. If moving an item out throws,
+// the item is lost, but the slot is released.
+template<typename T>
+class MpmcRingBuffer
+{
+    static_assert(std::is_nothrow_move_constructible_v<T>, "MpmcRingBuffer requires nothrow move constructible T");
+    static_assert(std::is_nothrow_destructible_v<T>, "MpmcRingBuffer requires nothrow destructible T");
+
+public:
+    NO_COPY_MOVE(MpmcRingBuffer);
+
+    explicit MpmcRingBuffer(size_t capacity)
+        : m_mask(roundCapacity(capacity) - 1),
+          m_cells(new Cell[m_mask + 1])
+    {
+        for (size_t i = 0; i <= m_mask; i++)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~MpmcRingBuffer() {
+        const auto end = m_enqueuePos.load();
+
+        for (auto pos = m_dequeuePos.load(); pos != end; pos++)
+            reinterpret_cast<T*>(m_cells[pos & m_mask].storage)->~T();
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // Approximate under concurrent access
+    size_t size() const {
+        const auto dequeuePos = m_dequeuePos.load(std::memory_order_relaxed);
+        const auto enqueuePos = m_enqueuePos.load(std::memory_order_relaxed);
+        return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    template<typename... Args>
+    bool tryEmplace(Args&&... args) {
+        if constexpr (!std::is_nothrow_constructible_v<T, Args&&...>) {
+            T value(std::forward<Args>(args)...);
+            return tryEmplace(std::move(value));
+        }
+
+        Cell* cell;
+        auto pos = m_enqueuePos.load(std::memory_order_relaxed);
+
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            const auto sequence = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+            if (diff == 0) {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false; // Full
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (cell->storage) T(std::forward<Args>(args)...);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPush(const T& value) { return tryEmplace(value); }
+    bool tryPush(T&& value) { return tryEmplace(std::move(value)); }
+
+    bool tryPop(T& value) {
+        Cell* cell;
+        auto pos = m_dequeuePos.load(std::memory_order_relaxed);
+
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            const auto sequence = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+
+            if (diff == 0) {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false; // Empty
+            } else {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        popFrom(*cell, pos, value);
+        return true;
+    }
+
+    // Bulk variants claim a run of consecutive slots with a single CAS.
+    // Push moves up to `count` items from `first` (iterator operations must not throw), returns number of pushed items.
+    template<typename It>
+    size_t tryPushBulk(It first, size_t count) {
+        auto pos = m_enqueuePos.load(std::memory_order_relaxed);
+        const auto claimed = claimRun(m_enqueuePos, pos, count, 0);
+
+        for (size_t i = 0; i < claimed; i++, ++first) {
+            auto& cell = m_cells[(pos + i) & m_mask];
+            new (cell.storage) T(std::move(*first));
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+
+        return claimed;
+    }
+
+    // Pops up to `count` items into `out` (output iterator), returns number of popped items
+    template<typename OutIt>
+    size_t tryPopBulk(OutIt out, size_t count) {
+        auto pos = m_dequeuePos.load(std::memory_order_relaxed);
+        const auto claimed = claimRun(m_dequeuePos, pos, count, 1);
+        size_t i = 0;
+
+        // If output throws, the rest of claimed items are dropped, so that their slots are released
+        auto dropRest = CreateScopedGuard([&](){
+            for (i++; i < claimed; i++) {
+                auto& cell = m_cells[(pos + i) & m_mask];
+                reinterpret_cast<T*>(cell.storage)->~T();
+                cell.sequence.store(pos + i + m_mask + 1, std::memory_order_release);
+            }
+        });
+
+        for (; i < claimed; i++) {
+            popFrom(m_cells[(pos + i) & m_mask], pos + i, *out);
+            ++out;
+        }
+
+        dropRest.reset();
+        return claimed;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    // Claims up to `count` consecutive slots starting from `position` with a single CAS.
+    // Slot is ready if its sequence is `position + lag` (0 - free for producer, 1 - filled for consumer).
+    // On return `pos` is the first claimed position.
+    size_t claimRun(std::atomic<size_t>& position, size_t& pos, size_t count, size_t lag) {
+        if (!count)
+            return 0;
+
+        for (;;) {
+            size_t claimed = 0;
+
+            while (claimed < count && claimed <= m_mask) {
+                const auto sequence = m_cells[(pos + claimed) & m_mask].sequence.load(std::memory_order_acquire);
+                if (sequence != pos + claimed + lag)
+                    break;
+
+                claimed++;
+            }
+
+            if (!claimed) {
+                const auto sequence = m_cells[pos & m_mask].sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + lag);
+
+                if (diff < 0)
+                    return 0; // Full / empty
+
+                // Position was advanced by another thread meanwhile
+                pos = position.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            if (position.compare_exchange_weak(pos, pos + claimed, std::memory_order_relaxed))
+                return claimed;
+        }
+    }
+
+    static size_t roundCapacity(size_t capacity) {
+        size_t result = 2;
+        while (result < capacity)
+            result <<= 1;
+        return result;
+    }
+
+    template<typename Output>
+    void popFrom(Cell& cell, size_t pos, Output&& output) {
+        auto& item = *reinterpret_cast<T*>(cell.storage);
+
+        // Slot is released even if output throws
+        auto release = CreateScopedGuard([this, &cell, &item, pos](){
+            item.~T();
+            cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+        });
+
+        output = std::move(item);
+    }
+
+private:
+    const size_t m_mask;
+    const std::unique_ptr<Cell[]> m_cells;
+
+    alignas(64) std::atomic<size_t> m_enqueuePos { 0 };
+    alignas(64) std::atomic<size_t> m_dequeuePos { 0 };
+};
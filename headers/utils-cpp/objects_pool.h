@@ -4,30 +4,211 @@
 
 #pragma once
 #include <type_traits>
+#include <array>
+#include <vector>
 #include <memory>
+#include <optional>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <new>
+#include <cstddef>
+#include <cstdint>
 #include <cassert>
 #include <utils-cpp/pimpl.h>
+#include <utils-cpp/default_ctor_ops.h>
 
 class ObjectsPoolBase;
 template<typename T> class ObjectsPool;
 template<typename T> using ObjectsPoolPtr = std::shared_ptr<ObjectsPool<T>>;
 
 
+enum class ObjectsPoolStorage
+{
+    Separate, // Each object is a separate heap allocation
+    Slab      // Objects appended together are constructed in one contiguous cache-line-aligned array
+};
+
+
+enum class ObjectsPoolRecycleMode
+{
+    Inline,  // `onReturn` hook runs in the returning thread
+    Deferred // `onReturn` hook runs in a background cleaner thread, object is available after that
+};
+
+
+struct ObjectsPoolOptions
+{
+    ObjectsPoolStorage storage { ObjectsPoolStorage::Separate };
+
+    // Per-thread cache ("magazine") of free objects.
+    // Each thread takes from / returns to its own cache first and exchanges
+    // objects with the shared pool in batches of `threadCacheSize / 2`.
+    // 0 - disabled.
+    size_t threadCacheSize { 0 };
+
+    // Number of free lists ("shards"), see `ObjectsPool<T>::createSharded`.
+    // Threads take from / return to the shard of the CPU they run on
+    // and steal from neighbouring shards only when the local one is empty.
+    // 1 - single free list, 0 - one shard per hardware thread.
+    size_t shards { 1 };
+
+    // Elastic mode, see `ObjectsPool<T>::createElastic`.
+    // Pool grows on demand up to `maxSize` objects and keeps at least `minSize`.
+    size_t minSize { 0 };
+    size_t maxSize { 0 };
+
+    // Free objects which weren't needed during this period are destroyed (down to `minSize`).
+    // 0 - never shrink.
+    std::chrono::milliseconds idleTimeout { 0 };
+
+    // New objects are created in background once free objects count drops below this value.
+    // 0 - create objects only on demand.
+    size_t lowWatermark { 0 };
+
+    // How `onReturn` hook is applied, see `ObjectsPool<T>::setRecycleHooks`.
+    // Deferred mode: cleaner resets objects in batches of `recycleBatchSize`, or after `recycleDelay`
+    // (0 - no time limit), or immediately when somebody waits for an object.
+    ObjectsPoolRecycleMode recycleMode { ObjectsPoolRecycleMode::Inline };
+    size_t recycleBatchSize { 1 };
+    std::chrono::milliseconds recycleDelay { 10 };
+
+    // Collect take counters, wait/hold time histograms and lease timestamps, see `ObjectsPoolBase::stats`.
+    // Costs a few relaxed atomic increments and two clock reads per take/return.
+    bool statistics { true };
+};
+
+
+struct ObjectsPoolThreadCacheStats
+{
+    uint64_t hits {};    // take() served from thread cache
+    uint64_t misses {};  // take() found thread cache empty
+    uint64_t refills {}; // Batches moved from shared pool to thread cache
+    uint64_t spills {};  // Batches moved from thread cache to shared pool
+};
+
+
+// Log2 histogram of durations.
+// Bucket 0 counts durations below 1 us, bucket N (N > 0) - durations in [2^(N-1), 2^N) us,
+// the last bucket also counts everything longer.
+struct ObjectsPoolHistogram
+{
+    static constexpr size_t Buckets = 32;
+
+    static size_t bucketOf(std::chrono::steady_clock::duration value) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(value).count();
+        size_t bucket = 0;
+
+        while (us > 0 && bucket < Buckets - 1) {
+            us >>= 1;
+            bucket++;
+        }
+
+        return bucket;
+    }
+
+    static std::chrono::microseconds upperBound(size_t bucket) { return std::chrono::microseconds(1ll << bucket); }
+
+    uint64_t total() const {
+        uint64_t result = 0;
+        for (auto x : counts) result += x;
+        return result;
+    }
+
+    std::array<uint64_t, Buckets> counts {};
+};
+
+
+struct ObjectsPoolStats
+{
+    size_t size {};              // Objects owned by pool
+    size_t inUse {};             // Objects currently taken
+    size_t peakInUse {};
+    uint64_t takes {};           // Successful takes
+    uint64_t failedTakes {};     // tryTake/takeFor/takeUntil which got nothing
+    uint64_t waitedTakes {};     // Takes which found the pool empty and had to wait (incl. timed out)
+    uint64_t lockContentions {}; // Pool mutex was found locked by another thread
+    uint64_t shardSteals {};     // Objects taken from a non-local shard
+    ObjectsPoolHistogram waitTime;
+    ObjectsPoolHistogram holdTime; // Time between take and return
+    ObjectsPoolThreadCacheStats threadCache;
+};
+
+
+struct ObjectsPoolLease
+{
+    uint32_t slot {};
+    std::chrono::steady_clock::duration heldFor {};
+};
+
+
+// Holds raw pointer to pool, no reference counting on take/return.
+// Pool stays alive while there are outstanding accessors (or batches), even if all
+// ObjectsPoolPtr's are gone: then the last returned object destroys the pool.
 class ObjectAccessorBase
 {
 public:
-    virtual ~ObjectAccessorBase();
+    NO_COPY(ObjectAccessorBase);
+    ObjectAccessorBase(ObjectAccessorBase&& rhs) noexcept;
+    ObjectAccessorBase& operator=(ObjectAccessorBase&& rhs) noexcept;
+    ~ObjectAccessorBase();
 
 protected:
-    ObjectAccessorBase(const std::shared_ptr<void>& obj,
-                       const std::shared_ptr<ObjectsPoolBase>& master);
+    ObjectAccessorBase(void* obj,
+                       uint32_t slot,
+                       ObjectsPoolBase* master);
 
     void* get_internal();
     const void* get_internal() const;
 
 private:
-    std::shared_ptr<void> object;
-    std::shared_ptr<ObjectsPoolBase> master;
+    void release();
+
+private:
+    void* object;
+    ObjectsPoolBase* master;
+    uint32_t slot;
+};
+
+
+// Move-only handle of objects taken at once, see `ObjectsPool<T>::takeMany`.
+// All objects are returned to pool together.
+class ObjectsBatchBase
+{
+public:
+    NO_COPY(ObjectsBatchBase);
+    ObjectsBatchBase(ObjectsBatchBase&& rhs) noexcept;
+    ObjectsBatchBase& operator=(ObjectsBatchBase&& rhs) noexcept;
+    ~ObjectsBatchBase();
+
+    size_t size() const { return objects.size(); }
+    bool empty() const { return objects.empty(); }
+
+    // Returns all objects to pool now
+    void release();
+
+protected:
+    ObjectsBatchBase(std::vector<uint32_t>&& slots,
+                     std::vector<void*>&& objects,
+                     ObjectsPoolBase* master);
+
+    void* get_internal(size_t index) const { assert(index < objects.size()); return objects[index]; }
+
+private:
+    std::vector<uint32_t> slots;
+    std::vector<void*> objects;
+    ObjectsPoolBase* master;
+};
+
+
+template<typename T>
+class ObjectsBatch : public ObjectsBatchBase
+{
+    template<typename> friend class ObjectsPool;
+    using ObjectsBatchBase::ObjectsBatchBase;
+public:
+    T& operator[](size_t index) { return *reinterpret_cast<T*>(get_internal(index)); }
+    const T& operator[](size_t index) const { return *reinterpret_cast<const T*>(get_internal(index)); }
 };
 
 
@@ -49,19 +230,80 @@ public:
 };
 
 
+// Pending asynchronous take, see `ObjectsPool<T>::takeAsync`
+class ObjectsPoolAsyncTake
+{
+    friend class ObjectsPoolBase;
+public:
+    // Returns true if request was still queued: its callback won't be invoked.
+    // False if it has been fulfilled already (or is being fulfilled right now), or the pool is gone.
+    bool cancel();
+
+private:
+    std::weak_ptr<ObjectsPoolBase> pool;
+    std::shared_ptr<void> request;
+};
+
+
 class ObjectsPoolBase : public std::enable_shared_from_this<ObjectsPoolBase>
 {
     friend class ObjectAccessorBase;
+    friend class ObjectsBatchBase;
+    friend class ObjectsPoolAsyncTake;
 public:
-    ObjectsPoolBase();
+    ObjectsPoolBase(const ObjectsPoolOptions& options = {});
     virtual ~ObjectsPoolBase();
 
+    const ObjectsPoolOptions& options() const;
+    size_t size() const; // Objects owned by pool, both free and taken
+    ObjectsPoolThreadCacheStats threadCacheStats() const;
+
+    // Snapshot of statistics. Counters are read one by one, so they may be slightly inconsistent.
+    // Only `size` and `inUse` are maintained if `ObjectsPoolOptions::statistics` is off.
+    ObjectsPoolStats stats() const;
+
+    // Objects taken earlier than `threshold` ago and not returned yet. Helps to find leaked or slow accessors.
+    std::vector<ObjectsPoolLease> longHeldLeases(std::chrono::steady_clock::duration threshold) const;
+
+    // Destroys up to `count` free objects which were created separately (elastic pool, append),
+    // never going below `ObjectsPoolOptions::minSize`. Returns number of destroyed objects.
+    size_t trim(size_t count);
+
+    // Invoked after objects become free (returned or added), outside of the pool lock.
+    // Intended for pool compositions like KeyedObjectsPool. Must be set before the pool is shared.
+    void setAvailabilityCallback(const std::function<void()>& callback);
+
+    // Blocks until all objects requested by `appendParallel` / `createParallel` are constructed.
+    // Rethrows the first exception thrown by a constructor, if any (other objects are still appended).
+    void waitForParallelAppends();
+
 protected:
+    struct TakenObject
+    {
+        void* object {};
+        uint32_t slot {};
+    };
+
     void baseAppend(const std::shared_ptr<void>& obj);
-    const std::shared_ptr<void> baseTake();
+    void baseAppendSlab(void* first, size_t stride, size_t count, const std::shared_ptr<void>& owner);
+    void baseAppendParallel(size_t count, size_t threads, const std::function<std::shared_ptr<void>()>& factory);
+    void baseMakeElastic(const std::function<std::shared_ptr<void>()>& factory);
+    void baseSetRecycleHooks(const std::function<void(void*)>& onTake, const std::function<void(void*)>& onReturn);
+    TakenObject baseTake();
+    bool baseTryTake(TakenObject& result);
+    bool baseTakeUntil(std::chrono::steady_clock::time_point deadline, TakenObject& result);
+    void baseTakeMany(size_t count, bool all, bool wait, const std::chrono::steady_clock::time_point* deadline,
+                      std::vector<uint32_t>& slots, std::vector<void*>& objects);
+    ObjectsPoolAsyncTake baseTakeAsync(const std::function<void(const TakenObject&)>& callback);
+
+    // Deleter of ObjectsPoolPtr: destroys pool now or after the last outstanding object is returned
+    void baseReleaseOwnership();
 
 private:
-    void returnObject(void* ptr);
+    void returnObject(uint32_t slot);
+    void returnObjects(const uint32_t* slots, size_t count);
+    void releaseLeases(size_t count);
+    void destroy();
 
 private:
     DECLARE_PIMPL
@@ -72,10 +314,17 @@ template<typename T>
 class ObjectsPool : public ObjectsPoolBase
 {
 public:
+    using Factory = std::function<std::unique_ptr<T>()>;
+
     template<typename... Args>
     static ObjectsPoolPtr<T> create(int count = 1, Args&&... args) {
+        return create(ObjectsPoolOptions(), count, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    static ObjectsPoolPtr<T> create(const ObjectsPoolOptions& options, int count = 1, Args&&... args) {
         assert(count >= 0);
-        auto pool = std::shared_ptr<ObjectsPool>(new ObjectsPool, [](ObjectsPool* p){ delete p; });
+        auto pool = std::shared_ptr<ObjectsPool>(new ObjectsPool(options), [](ObjectsPool* p){ p->baseReleaseOwnership(); });
 
         if (count > 0)
             pool->append(count, std::forward<Args>(args)...);
@@ -83,6 +332,40 @@ public:
         return pool;
     }
 
+    // Objects are constructed on `threads` background threads (0 - one per hardware thread),
+    // each one can be taken as soon as it's ready. See `appendParallel`.
+    template<typename... Args>
+    static ObjectsPoolPtr<T> createParallel(int count, size_t threads, const Args&... args) {
+        return createParallel(ObjectsPoolOptions(), count, threads, args...);
+    }
+
+    template<typename... Args>
+    static ObjectsPoolPtr<T> createParallel(const ObjectsPoolOptions& options, int count, size_t threads, const Args&... args) {
+        auto pool = std::shared_ptr<ObjectsPool>(new ObjectsPool(options), [](ObjectsPool* p){ p->baseReleaseOwnership(); });
+        pool->appendParallel(count, threads, args...);
+        return pool;
+    }
+
+    // Pool with one free list per CPU (or `options.shards` free lists), for many-core machines
+    // where a single free list head becomes the bottleneck. Otherwise the same as `create`.
+    template<typename... Args>
+    static ObjectsPoolPtr<T> createSharded(int count = 1, Args&&... args) {
+        ObjectsPoolOptions options;
+        options.shards = 0;
+        return create(options, count, std::forward<Args>(args)...);
+    }
+
+    // Elastic pool: starts with `options.minSize` objects and creates more with `factory`
+    // when it's exhausted, up to `options.maxSize`. Factory may return nullptr to refuse growth.
+    // See ObjectsPoolOptions for shrinking and background prewarm settings.
+    static ObjectsPoolPtr<T> createElastic(const ObjectsPoolOptions& options, const Factory& factory) {
+        assert(options.maxSize > 0 && options.minSize <= options.maxSize);
+        assert(factory);
+        auto pool = std::shared_ptr<ObjectsPool>(new ObjectsPool(options), [](ObjectsPool* p){ p->baseReleaseOwnership(); });
+        pool->baseMakeElastic([factory]() -> std::shared_ptr<void> { return std::shared_ptr<T>(factory()); });
+        return pool;
+    }
+
     template<typename Deleter = std::nullptr_t>
     void append(T* object, Deleter deleter = nullptr) {
         if constexpr (std::is_same<Deleter, std::nullptr_t>::value) {
@@ -96,10 +379,25 @@ public:
     void append(int count, Args&&... args) {
         assert (count > 0);
 
+        if (options().storage == ObjectsPoolStorage::Slab) {
+            appendSlab(count, args...);
+            return;
+        }
+
         for (int i = 0; i < count; i++)
             append(std::make_shared<T>(std::forward<Args>(args)...));
     }
 
+    // Returns immediately, objects are constructed in background and appended one by one.
+    // `args` are copied and shared by all builder threads, so constructors must treat them as read-only.
+    // Objects are separate allocations regardless of `ObjectsPoolOptions::storage`.
+    // Destroying the pool cancels construction of the remaining objects.
+    template<typename... Args>
+    void appendParallel(int count, size_t threads, const Args&... args) {
+        assert (count > 0);
+        baseAppendParallel(count, threads, [args...]() -> std::shared_ptr<void> { return std::make_shared<T>(args...); });
+    }
+
     template<typename... Args, typename Deleter>
     void appendWithDeleter(int count, Args&&... args, Deleter deleter) {
         assert (count > 0);
@@ -108,19 +406,145 @@ public:
             append(std::shared_ptr<T>(new T(std::forward<Args>(args)...), deleter));
     }
 
+    // Hooks for objects handed out (`onTake`) and returned (`onReturn`, e.g. reset).
+    // Must be set once, before objects are taken. Either hook may be empty.
+    // With `ObjectsPoolRecycleMode::Deferred` returned objects are reset in background
+    // and only clean objects are handed out.
+    void setRecycleHooks(const std::function<void(T&)>& onTake, const std::function<void(T&)>& onReturn) {
+        baseSetRecycleHooks(onTake ? [onTake](void* p){ onTake(*static_cast<T*>(p)); } : std::function<void(void*)>(),
+                            onReturn ? [onReturn](void* p){ onReturn(*static_cast<T*>(p)); } : std::function<void(void*)>());
+    }
+
     ObjectAccessor<T> take() {
         const auto obj = baseTake();
-        ObjectAccessor<T> accessor(obj, shared_from_this());
-        return accessor;
+        return ObjectAccessor<T>(obj.object, obj.slot, this);
+    }
+
+    // Non-blocking and deadline-bounded variants.
+    // Failure path doesn't allocate.
+    std::optional<ObjectAccessor<T>> tryTake() {
+        TakenObject obj;
+        if (!baseTryTake(obj))
+            return {};
+
+        return ObjectAccessor<T>(obj.object, obj.slot, this);
+    }
+
+    template<typename Rep, typename Period>
+    std::optional<ObjectAccessor<T>> takeFor(const std::chrono::duration<Rep, Period>& timeout) {
+        return takeUntil(std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(timeout));
+    }
+
+    template<typename Clock, typename Duration>
+    std::optional<ObjectAccessor<T>> takeUntil(const std::chrono::time_point<Clock, Duration>& deadline) {
+        TakenObject obj;
+        if (!baseTakeUntil(toSteady(deadline), obj))
+            return {};
+
+        return ObjectAccessor<T>(obj.object, obj.slot, this);
+    }
+
+    // Asynchronous variants, never block.
+    // If an object is free, callback is invoked immediately, in this thread. Otherwise request is queued
+    // together with blocked takers and callback is invoked by the thread which returns an object.
+    // Queued callback must not throw: the returning thread can't handle it, so the exception is ignored
+    // (its object goes back to pool).
+    // Requests still pending when the last ObjectsPoolPtr is released are dropped.
+    ObjectsPoolAsyncTake takeAsync(const std::function<void(ObjectAccessor<T>)>& callback) {
+        return baseTakeAsync([this, callback](const TakenObject& obj){ callback(ObjectAccessor<T>(obj.object, obj.slot, this)); });
+    }
+
+    // Future is broken (std::future_error) if request is cancelled via `request` or dropped
+    std::future<ObjectAccessor<T>> takeFuture(ObjectsPoolAsyncTake* request = nullptr) {
+        auto promise = std::make_shared<std::promise<ObjectAccessor<T>>>();
+        auto future = promise->get_future();
+        auto pending = takeAsync([promise](ObjectAccessor<T> accessor){ promise->set_value(std::move(accessor)); });
+
+        if (request)
+            *request = std::move(pending);
+
+        return future;
+    }
+
+    // Batch variants: objects are detached from / returned to pool in a single operation.
+    // takeMany - waits until all `count` objects are available.
+    //   `count` must not exceed `size()` plus objects still being added by `appendParallel` (or `maxSize`
+    //   of elastic pool), waiting variants fail at once otherwise. If some of those appends fail, use a deadline.
+    ObjectsBatch<T> takeMany(size_t count) {
+        return makeBatch(count, true, true, nullptr);
+    }
+
+    // tryTakeMany - all `count` objects or nothing, doesn't wait.
+    std::optional<ObjectsBatch<T>> tryTakeMany(size_t count) {
+        auto batch = makeBatch(count, true, false, nullptr);
+        return batch.empty() ? std::optional<ObjectsBatch<T>>() : std::optional<ObjectsBatch<T>>(std::move(batch));
+    }
+
+    // takeManyUntil - all `count` objects or nothing, waits until deadline.
+    template<typename Clock, typename Duration>
+    std::optional<ObjectsBatch<T>> takeManyUntil(size_t count, const std::chrono::time_point<Clock, Duration>& deadline) {
+        const auto steadyDeadline = toSteady(deadline);
+        auto batch = makeBatch(count, true, true, &steadyDeadline);
+        return batch.empty() ? std::optional<ObjectsBatch<T>>() : std::optional<ObjectsBatch<T>>(std::move(batch));
+    }
+
+    // takeUpTo - as many as available right now, but not more than `count`. Doesn't wait.
+    ObjectsBatch<T> takeUpTo(size_t count) {
+        return makeBatch(count, false, false, nullptr);
     }
 
 private:
-    ObjectsPool() {}
+    ObjectsPool(const ObjectsPoolOptions& options): ObjectsPoolBase(options) {}
     ~ObjectsPool() {};
 
     void append(const std::shared_ptr<T>& obj) {
         std::shared_ptr<void> ptr = std::static_pointer_cast<void>(obj);
         baseAppend(ptr);
     }
+
+    template<typename Clock, typename Duration>
+    static std::chrono::steady_clock::time_point toSteady(const std::chrono::time_point<Clock, Duration>& deadline) {
+        if constexpr (std::is_same<Clock, std::chrono::steady_clock>::value) {
+            return std::chrono::time_point_cast<std::chrono::steady_clock::duration>(deadline);
+        } else {
+            return std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(deadline - Clock::now());
+        }
+    }
+
+    ObjectsBatch<T> makeBatch(size_t count, bool all, bool wait, const std::chrono::steady_clock::time_point* deadline) {
+        assert(count > 0);
+        std::vector<uint32_t> slots;
+        std::vector<void*> objects;
+        baseTakeMany(count, all, wait, deadline, slots, objects);
+
+        const auto master = objects.empty() ? nullptr : this;
+        return ObjectsBatch<T>(std::move(slots), std::move(objects), master);
+    }
+
+    static constexpr size_t SlabAlignment = (alignof(T) > 64) ? alignof(T) : 64;
+
+    template<typename... Args>
+    void appendSlab(int count, const Args&... args) {
+        const auto memory = static_cast<T*>(::operator new(sizeof(T) * static_cast<size_t>(count), std::align_val_t(SlabAlignment)));
+        int constructed = 0;
+
+        try {
+            for (; constructed < count; constructed++)
+                new (memory + constructed) T(args...);
+        } catch (...) {
+            destroySlab(memory, constructed);
+            throw;
+        }
+
+        std::shared_ptr<void> owner(memory, [count](void* p){ destroySlab(static_cast<T*>(p), count); });
+        baseAppendSlab(memory, sizeof(T), static_cast<size_t>(count), owner);
+    }
+
+    static void destroySlab(T* memory, int count) {
+        for (int i = 0; i < count; i++)
+            memory[i].~T();
+
+        ::operator delete(memory, std::align_val_t(SlabAlignment));
+    }
 };
 
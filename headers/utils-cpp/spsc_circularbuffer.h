@@ -0,0 +1,44 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utils-cpp/default_ctor_ops.h>
+
+// Lock-free byte ring for exactly one producer thread and one consumer thread.
+// Same semantics as CircularBuffer: `write` stores as much as fits, `read` / `readRO` return what's available.
+// Producer calls `write`, consumer calls `read` / `readRO`; `size` may be called from anywhere (approximate).
+// Capacity is rounded up to a power of two.
+class SpscCircularBuffer
+{
+public:
+    NO_COPY_MOVE(SpscCircularBuffer);
+
+    SpscCircularBuffer(size_t capacity);
+    ~SpscCircularBuffer();
+
+    size_t size() const;
+    size_t capacity() const { return m_capacity; }
+    size_t write(const void* data, size_t bytes);
+    size_t read(void* data, size_t bytes, bool erase = true);
+    size_t readRO(void* data, size_t bytes) const;
+
+private:
+    size_t peek(void* data, size_t bytes, size_t head) const;
+
+private:
+    // Positions grow monotonically and wrap around with size_t, offset in storage is `position & mask`.
+    // Each side caches the other's position and reloads it only when it seems to lack data / space.
+    alignas(64) std::atomic<size_t> m_head { 0 }; // Consumer
+    mutable size_t m_cachedTail { 0 };
+
+    alignas(64) std::atomic<size_t> m_tail { 0 }; // Producer
+    size_t m_cachedHead { 0 };
+
+    alignas(64) const size_t m_capacity;
+    const size_t m_mask;
+    const std::unique_ptr<unsigned char[]> m_data;
+};
@@ -0,0 +1,155 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+#include "utils-cpp/blocking_circularbuffer.h"
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace {
+
+constexpr size_t NobodyWaits = (std::numeric_limits<size_t>::max)();
+
+} // namespace
+
+
+BlockingCircularBuffer::BlockingCircularBuffer(size_t capacity, const BlockingCircularBufferOptions& options)
+    : m_capacity(capacity),
+      m_writeWakeupThreshold((std::max<size_t>)(options.writeWakeupThreshold ? options.writeWakeupThreshold : capacity / 4, 1)),
+      m_buffer(capacity),
+      m_readersWanted(NobodyWaits),
+      m_writersWanted(NobodyWaits)
+{
+    assert(capacity > 0 && "BlockingCircularBuffer: zero capacity, writers would wait forever");
+}
+
+BlockingCircularBuffer::~BlockingCircularBuffer() = default;
+
+size_t BlockingCircularBuffer::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_buffer.size();
+}
+
+size_t BlockingCircularBuffer::tryWrite(const void* data, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_closed)
+        return 0;
+
+    const auto result = m_buffer.write(data, bytes);
+    notifyReaders();
+    return result;
+}
+
+size_t BlockingCircularBuffer::tryRead(void* data, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto result = m_buffer.read(data, bytes);
+    notifyWriters();
+    return result;
+}
+
+void BlockingCircularBuffer::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+
+    m_readersCv.notify_all();
+    m_writersCv.notify_all();
+}
+
+bool BlockingCircularBuffer::isClosed() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_closed;
+}
+
+size_t BlockingCircularBuffer::writeImpl(const void* d, size_t bytes, const std::chrono::steady_clock::time_point* deadline)
+{
+    const auto data = static_cast<const unsigned char*>(d);
+    size_t written = 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_closed) {
+        written += m_buffer.write(data + written, bytes - written);
+        notifyReaders();
+
+        if (written == bytes)
+            break;
+
+        const auto wanted = (std::min)(bytes - written, m_writeWakeupThreshold);
+
+        m_writersWaiting++;
+        m_writersWanted = (std::min)(m_writersWanted, wanted);
+
+        const auto ready = wait(lock, m_writersCv, deadline, [this, wanted](){
+            return m_closed || m_capacity - m_buffer.size() >= wanted;
+        });
+
+        if (!--m_writersWaiting)
+            m_writersWanted = NobodyWaits;
+
+        if (!ready)
+            break;
+    }
+
+    return written;
+}
+
+size_t BlockingCircularBuffer::readImpl(void* data, size_t minBytes, size_t maxBytes, const std::chrono::steady_clock::time_point* deadline)
+{
+    // Nothing to read into, don't wait for data
+    if (!maxBytes)
+        return 0;
+
+    const auto wanted = (std::max<size_t>)((std::min)({minBytes, maxBytes, m_capacity}), 1);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if (m_buffer.size() < wanted && !m_closed) {
+        m_readersWaiting++;
+        m_readersWanted = (std::min)(m_readersWanted, wanted);
+
+        wait(lock, m_readersCv, deadline, [this, wanted](){
+            return m_closed || m_buffer.size() >= wanted;
+        });
+
+        if (!--m_readersWaiting)
+            m_readersWanted = NobodyWaits;
+    }
+
+    const auto result = m_buffer.read(data, maxBytes);
+    notifyWriters();
+    return result;
+}
+
+template<typename Predicate>
+bool BlockingCircularBuffer::wait(std::unique_lock<std::mutex>& lock, std::condition_variable& cv,
+                                  const std::chrono::steady_clock::time_point* deadline, Predicate predicate)
+{
+    if (!deadline) {
+        cv.wait(lock, predicate);
+        return true;
+    }
+
+    return cv.wait_until(lock, *deadline, predicate);
+}
+
+// Both are called under the lock. Waiters with different requirements may be woken early, they re-check.
+void BlockingCircularBuffer::notifyReaders()
+{
+    if (m_readersWaiting && m_buffer.size() >= m_readersWanted)
+        m_readersCv.notify_all();
+}
+
+void BlockingCircularBuffer::notifyWriters()
+{
+    if (m_writersWaiting && m_capacity - m_buffer.size() >= m_writersWanted)
+        m_writersCv.notify_all();
+}
@@ -5,24 +5,136 @@
 #include "utils-cpp/circularbuffer.h"
 #include <cstring>
 #include <cassert>
+#include <utility>
+
+#ifndef UTILS_CPP_OS_WINDOWS
+#include <cerrno>
+#include <sys/uio.h>
+#endif // UTILS_CPP_OS_WINDOWS
+
+#include <new>
+
+#ifndef UTILS_CPP_OS_WINDOWS
+#include <sys/mman.h>
+#include <unistd.h>
+#endif // UTILS_CPP_OS_WINDOWS
+
+#ifdef UTILS_CPP_OS_LINUX
+#include "utils-cpp/scoped_guard.h"
+#endif // UTILS_CPP_OS_LINUX
+
+namespace {
+
+#ifdef UTILS_CPP_OS_LINUX
+// Maps `size` bytes (multiple of page size) of anonymous memory twice, back to back
+unsigned char* mapMirrored(size_t size)
+{
+    const auto fd = memfd_create("circularbuffer", MFD_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    auto fdGuard = CreateScopedGuard([fd](){ close(fd); });
+
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+        return nullptr;
+
+    // Reserve address space for both copies, then map the file over it
+    const auto area = mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED)
+        return nullptr;
+
+    const auto base = static_cast<unsigned char*>(area);
+
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(base, size * 2);
+        return nullptr;
+    }
+
+    return base;
+}
+
+// Maps anonymous memory backed by huge pages, `mappedSize` receives the size to unmap
+unsigned char* mapHugePages(size_t capacity, CircularBufferOptions::HugePages hugePages, size_t& mappedSize)
+{
+    constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+    if (hugePages == CircularBufferOptions::HugePages::Explicit) {
+        const auto size = (capacity + HugePageSize - 1) / HugePageSize * HugePageSize;
+        const auto area = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (area != MAP_FAILED) {
+            mappedSize = size;
+            return static_cast<unsigned char*>(area);
+        }
+
+        // No reserved huge pages, try transparent ones
+    }
+
+    const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const auto size = (capacity + pageSize - 1) / pageSize * pageSize;
+    const auto area = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (area == MAP_FAILED)
+        return nullptr;
+
+    madvise(area, size, MADV_HUGEPAGE); // Just a hint, THP may be disabled
+    mappedSize = size;
+    return static_cast<unsigned char*>(area);
+}
+#endif // UTILS_CPP_OS_LINUX
+
+#ifndef UTILS_CPP_OS_WINDOWS
+// Fills up to two iovec's from `spans` limited to `max` bytes in total, returns their count
+template<typename Span>
+int toIovecs(const std::array<Span, 2>& spans, size_t max, iovec (&result)[2])
+{
+    int count = 0;
+
+    for (const auto& x : spans) {
+        const auto size = x.size < max ? x.size : max;
+        if (!size)
+            break;
+
+        result[count].iov_base = const_cast<unsigned char*>(x.data);
+        result[count].iov_len = size;
+        count++;
+        max -= size;
+    }
+
+    return count;
+}
+#endif // UTILS_CPP_OS_WINDOWS
+
+} // namespace
 
 
 CircularBuffer::CircularBuffer(size_t capacity)
-    : m_capacity(capacity)
+    : CircularBuffer(capacity, {})
 {
-    m_data = new unsigned char[capacity];
+}
+
+CircularBuffer::CircularBuffer(size_t capacity, const CircularBufferOptions& options)
+    : m_options(options)
+{
+    allocate(capacity);
+    m_initialCapacity = m_capacity;
     reset();
 }
 
 CircularBuffer::CircularBuffer(const CircularBuffer& rhs)
-    : CircularBuffer(rhs.capacity())
+    : CircularBuffer(rhs.capacity(), rhs.m_options)
 {
     rhs.readRO(m_data, rhs.m_size);
     m_endIndex = rhs.m_size;
     m_size = rhs.m_size;
+    m_droppedBytes = rhs.m_droppedBytes;
+    m_initialCapacity = rhs.m_initialCapacity;
 }
 
 CircularBuffer::CircularBuffer(CircularBuffer&& rhs) noexcept
+    : m_options(std::move(rhs.m_options))
 {
     assert(!rhs.m_moved);
     this->tie() = rhs.tie();
@@ -34,9 +146,11 @@ CircularBuffer::~CircularBuffer()
     if (m_moved)
         return;
 
-    delete[] m_data;
+    deallocate();
 }
 
+// Same as the copy constructor: contents, options and storage policy are taken from `rhs`.
+// New storage is allocated first, so this object is intact if it throws.
 CircularBuffer& CircularBuffer::operator=(const CircularBuffer& rhs)
 {
     assert(!rhs.m_moved);
@@ -44,18 +158,8 @@ CircularBuffer& CircularBuffer::operator=(const CircularBuffer& rhs)
     if (this == &rhs)
         return *this;
 
-    if (m_capacity != rhs.m_capacity) {
-        auto buffer = new unsigned char[rhs.m_capacity];
-
-        delete[] m_data;
-        m_data = buffer;
-        m_capacity = rhs.m_capacity;
-    }
-
-    rhs.readRO(m_data, rhs.m_size);
-    m_begIndex = 0;
-    m_endIndex = rhs.m_size;
-    m_size = rhs.m_size;
+    CircularBuffer temp(rhs);
+    *this = std::move(temp);
 
     return *this;
 }
@@ -67,7 +171,10 @@ CircularBuffer& CircularBuffer::operator=(CircularBuffer&& rhs) noexcept
     if (this == &rhs)
         return *this;
 
-    delete[] m_data;
+    if (!m_moved)
+        deallocate();
+
+    m_options = std::move(rhs.m_options);
     this->tie() = rhs.tie();
     rhs.m_moved = true;
 
@@ -79,16 +186,27 @@ size_t CircularBuffer::write(const void* d, size_t bytes)
     assert(!m_moved);
     if (bytes == 0) return 0;
 
+    growFor(bytes);
+
     const unsigned char* data = (const unsigned char*)d;
     size_t capacity = m_capacity;
-    size_t bytes_to_write = min(bytes, capacity - m_size);
+    const size_t requested = bytes;
 
-    // Write in a single step
-    if (bytes_to_write <= capacity - m_endIndex)
+    // Overwrite mode: only the tail of the data fits
+    if (m_options.overwrite && bytes > capacity) {
+        m_droppedBytes += bytes - capacity;
+        data += bytes - capacity;
+        bytes = capacity;
+    }
+
+    size_t bytes_to_write = makeRoom(bytes);
+
+    // Write in a single step (mirrored storage continues past the end)
+    if (bytes_to_write <= capacity - m_endIndex || m_mirrored)
     {
         memcpy(m_data + m_endIndex, data, bytes_to_write);
         m_endIndex += bytes_to_write;
-        if (m_endIndex == capacity) m_endIndex = 0;
+        if (m_endIndex >= capacity) m_endIndex -= capacity;
     }
     // Write in two steps
     else
@@ -101,7 +219,7 @@ size_t CircularBuffer::write(const void* d, size_t bytes)
     }
 
     m_size += bytes_to_write;
-    return bytes_to_write;
+    return m_options.overwrite ? requested : bytes_to_write;
 }
 
 size_t CircularBuffer::fill(unsigned char byte, size_t size)
@@ -109,15 +227,24 @@ size_t CircularBuffer::fill(unsigned char byte, size_t size)
     assert(!m_moved);
     if (size == 0) return 0;
 
+    growFor(size);
+
     size_t capacity = m_capacity;
-    size_t bytes_to_write = min(size, capacity - m_size);
+    const size_t requested = size;
+
+    if (m_options.overwrite && size > capacity) {
+        m_droppedBytes += size - capacity;
+        size = capacity;
+    }
+
+    size_t bytes_to_write = makeRoom(size);
 
     // Write in a single step
-    if (bytes_to_write <= capacity - m_endIndex)
+    if (bytes_to_write <= capacity - m_endIndex || m_mirrored)
     {
         memset(m_data + m_endIndex, byte, bytes_to_write);
         m_endIndex += bytes_to_write;
-        if (m_endIndex == capacity) m_endIndex = 0;
+        if (m_endIndex >= capacity) m_endIndex -= capacity;
     }
     // Write in two steps
     else
@@ -130,7 +257,7 @@ size_t CircularBuffer::fill(unsigned char byte, size_t size)
     }
 
     m_size += bytes_to_write;
-    return bytes_to_write;
+    return m_options.overwrite ? requested : bytes_to_write;
 }
 
 size_t CircularBuffer::read(void* d, size_t bytes, bool erase)
@@ -148,11 +275,11 @@ size_t CircularBuffer::read(void* d, size_t bytes, bool erase)
     size_t& begIndex = erase ? m_begIndex : temp_begIndex;
 
     // Read in a single step
-    if (bytes_to_read <= capacity - begIndex)
+    if (bytes_to_read <= capacity - begIndex || m_mirrored)
     {
         memcpy(data, m_data + begIndex, bytes_to_read);
         begIndex += bytes_to_read;
-        if (begIndex == capacity) begIndex = 0;
+        if (begIndex >= capacity) begIndex -= capacity;
     }
     // Read in two steps
     else
@@ -165,6 +292,10 @@ size_t CircularBuffer::read(void* d, size_t bytes, bool erase)
     }
 
     size -= bytes_to_read;
+
+    if (erase)
+        shrinkIfIdle();
+
     return bytes_to_read;
 }
 
@@ -181,3 +312,314 @@ void CircularBuffer::reset()
     m_endIndex = 0;
     m_size = 0;
 }
+
+std::array<CircularBuffer::ConstSpan, 2> CircularBuffer::readableSpans() const
+{
+    assert(!m_moved);
+    const auto first = m_mirrored ? m_size : min(m_size, m_capacity - m_begIndex);
+    return {{ {m_data + m_begIndex, first}, {m_data, m_size - first} }};
+}
+
+std::array<CircularBuffer::Span, 2> CircularBuffer::writableSpans()
+{
+    assert(!m_moved);
+    const auto free = m_capacity - m_size;
+    const auto first = m_mirrored ? free : min(free, m_capacity - m_endIndex);
+    return {{ {m_data + m_endIndex, first}, {m_data, free - first} }};
+}
+
+void CircularBuffer::consume(size_t bytes)
+{
+    assert(!m_moved);
+    assert(bytes <= m_size);
+
+    m_size -= bytes;
+
+    // Empty buffer: start from the beginning, so that the next writes are contiguous
+    if (!m_size) {
+        m_begIndex = 0;
+        m_endIndex = 0;
+    } else {
+        m_begIndex += bytes;
+        if (m_begIndex >= m_capacity) m_begIndex -= m_capacity;
+    }
+
+    shrinkIfIdle();
+}
+
+void CircularBuffer::commit(size_t bytes)
+{
+    assert(!m_moved);
+    assert(bytes <= m_capacity - m_size);
+
+    m_size += bytes;
+    m_endIndex += bytes;
+    if (m_endIndex >= m_capacity) m_endIndex -= m_capacity;
+}
+
+bool CircularBuffer::equalsAt(size_t offset, const unsigned char* pattern, size_t size) const
+{
+    auto index = m_begIndex + offset;
+    if (index >= m_capacity && !m_mirrored) index -= m_capacity;
+
+    const auto first = m_mirrored ? size : min(size, m_capacity - index);
+
+    return memcmp(m_data + index, pattern, first) == 0 &&
+           memcmp(m_data, pattern + first, size - first) == 0;
+}
+
+// Returns how many of `bytes` can be written, discarding the oldest data in overwrite mode
+size_t CircularBuffer::makeRoom(size_t bytes)
+{
+    const auto free = m_capacity - m_size;
+
+    if (!m_options.overwrite || bytes <= free)
+        return min(bytes, free);
+
+    const auto dropped = bytes - free;
+    m_droppedBytes += dropped;
+    m_size -= dropped;
+    m_begIndex += dropped;
+    if (m_begIndex >= m_capacity) m_begIndex -= m_capacity;
+
+    return bytes;
+}
+
+std::optional<size_t> CircularBuffer::find(unsigned char byte, size_t from) const
+{
+    assert(!m_moved);
+    const auto spans = readableSpans();
+
+    if (from < spans[0].size) {
+        if (const auto found = memchr(spans[0].data + from, byte, spans[0].size - from))
+            return static_cast<size_t>(static_cast<const unsigned char*>(found) - spans[0].data);
+        from = 0;
+    } else {
+        from -= spans[0].size;
+    }
+
+    if (from < spans[1].size) {
+        if (const auto found = memchr(spans[1].data + from, byte, spans[1].size - from))
+            return spans[0].size + static_cast<size_t>(static_cast<const unsigned char*>(found) - spans[1].data);
+    }
+
+    return {};
+}
+
+std::optional<size_t> CircularBuffer::find(const void* p, size_t size, size_t from) const
+{
+    assert(!m_moved);
+    const auto pattern = static_cast<const unsigned char*>(p);
+
+    if (!size)
+        return from <= m_size ? std::optional<size_t>(from) : std::optional<size_t>();
+
+    // Candidates are found by the first byte, then compared in place
+    while (from + size <= m_size) {
+        const auto candidate = find(pattern[0], from);
+
+        if (!candidate || *candidate + size > m_size)
+            break;
+
+        if (equalsAt(*candidate, pattern, size))
+            return candidate;
+
+        from = *candidate + 1;
+    }
+
+    return {};
+}
+
+#ifndef UTILS_CPP_OS_WINDOWS
+ptrdiff_t CircularBuffer::readFromFd(int fd, size_t max)
+{
+    assert(!m_moved);
+    assert(max);
+
+    if (m_size == m_capacity)
+        growFor(1);
+
+    iovec iov[2];
+    const auto count = toIovecs(writableSpans(), max, iov);
+
+    // Distinct from EOF
+    if (!count) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    ssize_t result;
+    do {
+        result = ::readv(fd, iov, count);
+    } while (result < 0 && errno == EINTR);
+
+    if (result > 0)
+        commit(static_cast<size_t>(result));
+
+    return result;
+}
+
+ptrdiff_t CircularBuffer::writeToFd(int fd, size_t max)
+{
+    assert(!m_moved);
+    assert(max);
+
+    iovec iov[2];
+    const auto count = toIovecs(readableSpans(), max, iov);
+    if (!count)
+        return 0;
+
+    ssize_t result;
+    do {
+        result = ::writev(fd, iov, count);
+    } while (result < 0 && errno == EINTR);
+
+    if (result > 0)
+        consume(static_cast<size_t>(result));
+
+    return result;
+}
+#endif // UTILS_CPP_OS_WINDOWS
+
+void CircularBuffer::growFor(size_t bytes)
+{
+    const auto required = m_size + bytes;
+
+    if (required <= m_capacity || m_options.maxCapacity <= m_capacity)
+        return;
+
+    auto capacity = m_capacity * 2;
+    if (capacity < required) capacity = required;
+    if (capacity > m_options.maxCapacity) capacity = m_options.maxCapacity;
+
+    reallocate(capacity);
+}
+
+void CircularBuffer::shrinkIfIdle()
+{
+    if (!m_options.shrinkAfterReads || m_capacity <= m_initialCapacity)
+        return;
+
+    if (m_size > m_capacity / 4) {
+        m_lowReads = 0;
+        return;
+    }
+
+    if (++m_lowReads < m_options.shrinkAfterReads)
+        return;
+
+    m_lowReads = 0;
+    const auto half = m_capacity / 2;
+    reallocate(half > m_initialCapacity ? half : m_initialCapacity);
+}
+
+// Moves contents to new storage of `capacity` bytes (not less than size), unwrapping them
+void CircularBuffer::reallocate(size_t capacity)
+{
+    assert(capacity >= m_size);
+
+    CircularBuffer temp(capacity, m_options);
+    readRO(temp.m_data, m_size);
+
+    // Old storage is released by `temp`
+    swapStorage(temp);
+
+    m_begIndex = 0;
+    m_endIndex = m_size < m_capacity ? m_size : 0;
+}
+
+void CircularBuffer::allocate(size_t capacity)
+{
+    m_capacity = capacity;
+    m_data = nullptr;
+    m_mirrored = false;
+    m_storage = Storage::Heap;
+    m_mappedSize = 0;
+    m_locked = false;
+
+#ifdef UTILS_CPP_OS_LINUX
+    if (m_options.mirrored && capacity) {
+        const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const auto size = (capacity + pageSize - 1) / pageSize * pageSize;
+
+        if ((m_data = mapMirrored(size))) {
+            m_capacity = size;
+            m_mirrored = true;
+            m_storage = Storage::Mirrored;
+            m_mappedSize = size * 2;
+        }
+    }
+#endif // UTILS_CPP_OS_LINUX
+
+    if (!m_data && m_options.allocate && capacity) {
+        assert(m_options.deallocate);
+        m_data = static_cast<unsigned char*>(m_options.allocate(capacity));
+        assert(m_data);
+        m_storage = Storage::User;
+    }
+
+#ifdef UTILS_CPP_OS_LINUX
+    if (!m_data && m_options.hugePages != CircularBufferOptions::HugePages::None && capacity) {
+        if ((m_data = mapHugePages(capacity, m_options.hugePages, m_mappedSize)))
+            m_storage = Storage::Mapped;
+    }
+#endif // UTILS_CPP_OS_LINUX
+
+    if (!m_data) {
+        if (m_options.alignment) {
+            assert((m_options.alignment & (m_options.alignment - 1)) == 0);
+            m_data = static_cast<unsigned char*>(::operator new[](capacity, std::align_val_t(m_options.alignment)));
+            m_storage = Storage::AlignedHeap;
+        } else {
+            m_data = new unsigned char[capacity];
+        }
+    }
+
+#ifndef UTILS_CPP_OS_WINDOWS
+    if (m_options.lock && capacity)
+        m_locked = mlock(m_data, m_mirrored ? m_mappedSize : m_capacity) == 0;
+#endif // UTILS_CPP_OS_WINDOWS
+}
+
+void CircularBuffer::deallocate()
+{
+#ifndef UTILS_CPP_OS_WINDOWS
+    if (m_locked) {
+        munlock(m_data, m_mirrored ? m_mappedSize : m_capacity);
+        m_locked = false;
+    }
+#endif // UTILS_CPP_OS_WINDOWS
+
+    switch (m_storage) {
+        case Storage::Heap:
+            delete[] m_data;
+            break;
+
+        case Storage::AlignedHeap:
+            ::operator delete[](m_data, std::align_val_t(m_options.alignment));
+            break;
+
+        case Storage::User:
+            m_options.deallocate(m_data, m_capacity);
+            break;
+
+        case Storage::Mapped:
+        case Storage::Mirrored:
+#ifndef UTILS_CPP_OS_WINDOWS
+            munmap(m_data, m_mappedSize);
+#endif // UTILS_CPP_OS_WINDOWS
+            break;
+    }
+
+    m_data = nullptr;
+}
+
+void CircularBuffer::swapStorage(CircularBuffer& other)
+{
+    std::swap(m_data, other.m_data);
+    std::swap(m_capacity, other.m_capacity);
+    std::swap(m_mirrored, other.m_mirrored);
+    std::swap(m_storage, other.m_storage);
+    std::swap(m_mappedSize, other.m_mappedSize);
+    std::swap(m_locked, other.m_locked);
+}
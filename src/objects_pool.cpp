@@ -3,94 +3,1636 @@
  * Contact:  ihor-drachuk-libs@pm.me  */
 
 #include "utils-cpp/objects_pool.h"
+#include "utils-cpp/scoped_guard.h"
+#include "utils-cpp/threadid.h"
 
-#include <vector>
+#include <algorithm>
+#include <array>
+#include <limits>
 #include <mutex>
 #include <condition_variable>
-#include <algorithm>
+#include <exception>
 #include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef UTILS_CPP_COMPILER_MSVC
+#include <intrin.h>
+#endif // UTILS_CPP_COMPILER_MSVC
+
+#if defined(UTILS_CPP_OS_LINUX)
+#include <sched.h>
+#elif defined(UTILS_CPP_OS_WINDOWS)
+#include <windows.h>
+#endif // UTILS_CPP_OS_LINUX
+
+namespace {
 
-using LockPtr = std::shared_ptr<std::unique_lock<std::mutex>>;
+constexpr uint32_t NoSlot = 0xFFFFFFFF;
 
+// Pool owning the current thread (cleaner, maintenance or builder), if any
+thread_local const void* t_internalThreadOf = nullptr;
 
-struct ObjectContext
+inline uint32_t floorLog2(uint32_t value)
 {
-    std::shared_ptr<void> obj;
-    std::unique_ptr<std::atomic_bool> isUsed = std::make_unique<std::atomic_bool>(false);
+    assert(value);
+#ifdef UTILS_CPP_COMPILER_MSVC
+    unsigned long result;
+    _BitScanReverse(&result, value);
+    return static_cast<uint32_t>(result);
+#else
+    return static_cast<uint32_t>(31 - __builtin_clz(value));
+#endif // UTILS_CPP_COMPILER_MSVC
+}
+
+// Kept small and in contiguous segments: object pointer, index of its owner
+// in `impl_t::owners` (separate allocation or whole slab), free list link and lease start time.
+// Slots of destroyed objects (elastic mode) are reused.
+struct Slot
+{
+    void* object {};
+    uint32_t owner {};
+    std::atomic<uint32_t> next { NoSlot };
+    std::atomic<int64_t> takenAt { 0 }; // steady_clock ticks, 0 - not taken by user (statistics)
 };
 
+// Slots are stored in segments of growing size (16, 32, 64, ...).
+// Segments are never moved or freed until the pool dies, so slot
+// lookup by index doesn't need any lock, even while the pool grows.
+class SlotTable
+{
+public:
+    static constexpr uint32_t FirstSegmentBits = 4;
+    static constexpr uint32_t FirstSegmentSize = 1u << FirstSegmentBits;
+    static constexpr size_t MaxSegments = 32 - FirstSegmentBits;
+
+    SlotTable() = default;
+    SlotTable(const SlotTable&) = delete;
+    SlotTable& operator=(const SlotTable&) = delete;
+
+    ~SlotTable() {
+        for (size_t i = 0; i < MaxSegments; i++)
+            delete[] m_segments[i].load(std::memory_order_relaxed);
+    }
+
+    Slot& operator[](uint32_t index) {
+        const auto virtualIndex = index + FirstSegmentSize;
+        const auto segment = floorLog2(virtualIndex) - FirstSegmentBits;
+        const auto offset = virtualIndex - (FirstSegmentSize << segment);
+        return m_segments[segment].load(std::memory_order_acquire)[offset];
+    }
+
+    uint32_t size() const { return m_size; }
+
+    // Not thread-safe, must be serialized by caller
+    uint32_t add() {
+        const auto index = m_size;
+        const auto virtualIndex = index + FirstSegmentSize;
+        const auto segment = floorLog2(virtualIndex) - FirstSegmentBits;
+        assert(segment < MaxSegments && index != NoSlot);
+
+        if (!m_segments[segment].load(std::memory_order_relaxed))
+            m_segments[segment].store(new Slot[FirstSegmentSize << segment], std::memory_order_release);
+
+        m_size++;
+        return index;
+    }
+
+private:
+    std::array<std::atomic<Slot*>, MaxSegments> m_segments {};
+    uint32_t m_size {};
+};
+
+// Per-thread cache of free slots.
+// The mutex is normally taken only by the owning thread, so it stays uncontended
+// and in the owner's cache. Other threads lock it only to steal from
+// an exhausted pool, or to adopt the magazine after its owner thread exited.
+struct Magazine
+{
+    Magazine(size_t capacity): items(std::make_unique<uint32_t[]>(capacity)) {}
+
+    alignas(64) std::mutex mutex;
+    std::unique_ptr<uint32_t[]> items;
+    size_t count {};
+    bool orphaned {};
+    ObjectsPoolThreadCacheStats stats;
+};
+
+using MagazinePtr = std::shared_ptr<Magazine>;
+
+struct ThreadMagazines
+{
+    ~ThreadMagazines() {
+        for (const auto& x : magazines) {
+            if (const auto magazine = x.second.lock()) {
+                std::lock_guard<std::mutex> lock(magazine->mutex);
+                magazine->orphaned = true;
+            }
+        }
+    }
+
+    uint64_t lastPoolId {};
+    Magazine* lastMagazine {};
+    std::unordered_map<uint64_t, std::weak_ptr<Magazine>> magazines;
+};
+
+class AtomicHistogram
+{
+public:
+    void add(std::chrono::steady_clock::duration value) {
+        m_counts[ObjectsPoolHistogram::bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ObjectsPoolHistogram snapshot() const {
+        ObjectsPoolHistogram result;
+        for (size_t i = 0; i < ObjectsPoolHistogram::Buckets; i++)
+            result.counts[i] = m_counts[i].load(std::memory_order_relaxed);
+        return result;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, ObjectsPoolHistogram::Buckets> m_counts {};
+};
+
+// Set in `Counters::inUse` when the pool isn't owned by any ObjectsPoolPtr anymore
+constexpr size_t OrphanedFlag = size_t(1) << (sizeof(size_t) * 8 - 2);
+
+// Statistics of a group of threads, on its own cache lines
+struct alignas(64) StatStripe
+{
+    std::atomic<uint64_t> takes { 0 };
+    std::atomic<uint64_t> failedTakes { 0 };
+    std::atomic<uint64_t> waitedTakes { 0 };
+    std::atomic<uint64_t> lockContentions { 0 };
+    std::atomic<uint64_t> shardSteals { 0 };
+    AtomicHistogram waitTime;
+    AtomicHistogram holdTime;
+};
+
+inline size_t currentStripe()
+{
+    static std::atomic<size_t> counter { 0 };
+    thread_local const size_t stripe = counter++;
+    return stripe;
+}
+
+// Statistics counters. Threads are spread over stripes round-robin, so that takes and returns
+// of different threads don't write the same cache line; `stats` sums the stripes.
+// `inUse` is also the outstanding leases counter, which keeps the pool alive.
+struct Counters
+{
+    static constexpr size_t MaxStripes = 16;
+
+    Counters(size_t stripes): stripeCount(stripes), stripes(new StatStripe[stripes]) {}
+
+    StatStripe& local() { return stripes[stripeCount > 1 ? currentStripe() % stripeCount : 0]; }
+
+    alignas(64) std::atomic<size_t> inUse { 0 };
+    alignas(64) std::atomic<size_t> peakInUse { 0 }; // Read by every take, written only on a new peak
+    const size_t stripeCount;
+    const std::unique_ptr<StatStripe[]> stripes;
+};
+
+inline int64_t steadyTicks()
+{
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+inline uint32_t headIndex(uint64_t head) { return static_cast<uint32_t>(head); }
+inline uint64_t makeHead(uint64_t prevHead, uint32_t index) { return (((prevHead >> 32) + 1) << 32) | index; }
+
+struct alignas(64) FreeList
+{
+    std::atomic<uint64_t> head { NoSlot };
+
+    void push(SlotTable& slots, uint32_t index) {
+        auto& slot = slots[index];
+        auto current = head.load(std::memory_order_relaxed);
+
+        do {
+            slot.next.store(headIndex(current), std::memory_order_relaxed);
+        } while (!head.compare_exchange_weak(current, makeHead(current, index)));
+    }
+
+    uint32_t pop(SlotTable& slots) {
+        auto current = head.load();
+
+        while (headIndex(current) != NoSlot) {
+            const auto next = slots[headIndex(current)].next.load(std::memory_order_relaxed);
+            if (head.compare_exchange_weak(current, makeHead(current, next)))
+                return headIndex(current);
+        }
+
+        return NoSlot;
+    }
+
+    // Links `count` slots into a chain and publishes it with a single CAS
+    void pushChain(SlotTable& slots, const uint32_t* indices, size_t count) {
+        assert(count);
+
+        for (size_t i = 0; i + 1 < count; i++)
+            slots[indices[i]].next.store(indices[i + 1], std::memory_order_relaxed);
+
+        auto& last = slots[indices[count - 1]];
+        auto current = head.load(std::memory_order_relaxed);
+
+        do {
+            last.next.store(headIndex(current), std::memory_order_relaxed);
+        } while (!head.compare_exchange_weak(current, makeHead(current, indices[0])));
+    }
+
+    // Detaches up to `count` slots with a single CAS.
+    // If CAS succeeds, head didn't change since it was read (tag), so the walked chain was stable.
+    size_t popChain(SlotTable& slots, uint32_t* indices, size_t count) {
+        auto current = head.load();
+
+        while (headIndex(current) != NoSlot) {
+            size_t taken = 0;
+            auto index = headIndex(current);
+
+            while (index != NoSlot && taken < count) {
+                indices[taken++] = index;
+                index = slots[index].next.load(std::memory_order_relaxed);
+            }
+
+            if (head.compare_exchange_weak(current, makeHead(current, index)))
+                return taken;
+        }
+
+        return 0;
+    }
+};
+
+// Shard selection: CPU the thread currently runs on, where the OS tells it cheaply,
+// otherwise sequential thread id
+inline size_t currentShardHint()
+{
+#ifdef UTILS_CPP_OS_WINDOWS
+    return GetCurrentProcessorNumber();
+#else
+#ifdef UTILS_CPP_OS_LINUX
+    const auto cpu = sched_getcpu();
+    if (cpu >= 0)
+        return static_cast<size_t>(cpu);
+#endif // UTILS_CPP_OS_LINUX
+
+    return static_cast<size_t>(currentThreadId());
+#endif // UTILS_CPP_OS_WINDOWS
+}
+
+struct Owner
+{
+    std::shared_ptr<void> ptr;
+    bool removable {}; // Owns exactly one object, which can be destroyed individually
+};
+
+std::atomic<uint64_t> poolIdCounter { 0 };
+
+// Blocked taker, lives on its stack.
+// Asynchronous taker lives in heap and is owned by the queue (`keepAlive`) until it gets an object or is cancelled.
+struct Waiter
+{
+    uint32_t* indices {}; // Granted slots
+    size_t needed {};
+    size_t granted {};
+    std::condition_variable cv;
+    Waiter* next {};
+
+    uint32_t slot { NoSlot }; // Storage for asynchronous taker
+    std::function<void(uint32_t)> onGranted;
+    std::chrono::steady_clock::time_point since;
+    std::shared_ptr<Waiter> keepAlive;
+};
+
+using GrantedWaiters = std::vector<std::shared_ptr<Waiter>>;
+
+} // namespace
+
 
 struct ObjectsPoolBase::impl_t
 {
-    std::vector<ObjectContext> objects;
-    std::atomic_int available { 0 };
+    impl_t(const ObjectsPoolOptions& options)
+        : options(options),
+          cacheBatch((std::max)(options.threadCacheSize / 2, size_t(1))),
+          shards(options.shards ? options.shards : (std::max)(std::thread::hardware_concurrency(), 1u))
+    { }
+
+    const ObjectsPoolOptions options;
+    const size_t cacheBatch;
+    const uint64_t poolId { ++poolIdCounter };
+
+    // Guarded by `mutex`
+    SlotTable slots;
+    std::vector<Owner> owners;
+    std::vector<uint32_t> retiredSlots;
+    std::vector<uint32_t> retiredOwners;
+
+    std::atomic<size_t> total { 0 }; // Live objects
+
+    // Free lists ("shards"): Treiber stacks of slot indices, each on its own cache line.
+    // Head is packed as {tag:32, index:32}, tag is incremented on each change to avoid ABA.
+    const size_t shards;
+    std::unique_ptr<FreeList[]> freeLists { new FreeList[shards] };
+
+    // Slow path: used only when the pool is empty.
+    // Blocked takers form a FIFO queue, `waiters` is its length. While it isn't empty,
+    // free objects are handed to the oldest waiter and other takers don't touch the free list.
+    alignas(64) std::atomic<int> waiters { 0 };
     std::mutex mutex;
-    std::condition_variable cv;
+    Waiter* waitersHead {}; // Guarded by `mutex`
+    Waiter* waitersTail {};
+
+    Counters counters { options.statistics ? (std::min)(size_t((std::max)(std::thread::hardware_concurrency(), 1u)), Counters::MaxStripes) : 1 };
+
+    std::unique_lock<std::mutex> lock() {
+        std::unique_lock<std::mutex> result(mutex, std::try_to_lock);
+
+        if (!result.owns_lock()) {
+            counters.local().lockContentions.fetch_add(1, std::memory_order_relaxed);
+            result.lock();
+        }
+
+        return result;
+    }
+
+    size_t homeShard() const { return shards > 1 ? currentShardHint() % shards : 0; }
+
+    // Returned objects go to the shard of the current CPU
+    void push(uint32_t index) {
+        freeLists[homeShard()].push(slots, index);
+    }
+
+    void pushChain(const uint32_t* indices, size_t count) {
+        if (count)
+            freeLists[homeShard()].pushChain(slots, indices, count);
+    }
+
+    // Local shard first, then neighbouring ones
+    uint32_t pop() {
+        const auto home = homeShard();
+        auto index = freeLists[home].pop(slots);
+
+        for (size_t i = 1; i < shards && index == NoSlot; i++) {
+            index = freeLists[(home + i) % shards].pop(slots);
+            if (index != NoSlot)
+                counters.local().shardSteals.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        return index;
+    }
+
+    size_t popChain(uint32_t* indices, size_t count) {
+        const auto home = homeShard();
+        auto taken = freeLists[home].popChain(slots, indices, count);
+
+        for (size_t i = 1; i < shards && taken < count; i++) {
+            const auto stolen = freeLists[(home + i) % shards].popChain(slots, indices + taken, count - taken);
+            if (stolen)
+                counters.local().shardSteals.fetch_add(stolen, std::memory_order_relaxed);
+            taken += stolen;
+        }
+
+        return taken;
+    }
+
+    // Waiters queue, must be called under `mutex`
+    void enqueue(Waiter& waiter) {
+        (waitersTail ? waitersTail->next : waitersHead) = &waiter;
+        waitersTail = &waiter;
+        waiters++;
+    }
+
+    void dequeue(Waiter& waiter) {
+        Waiter* prev = nullptr;
+        auto current = waitersHead;
+
+        while (current != &waiter) {
+            prev = current;
+            current = current->next;
+            assert(current);
+        }
+
+        (prev ? prev->next : waitersHead) = waiter.next;
+        if (waitersTail == &waiter)
+            waitersTail = prev;
+
+        waiter.next = nullptr;
+        waiters--;
+    }
+
+    // Hands free objects to waiters in arrival order.
+    // The oldest waiter collects objects until it has all it asked for, the next ones wait behind it.
+    // Satisfied asynchronous takers are moved to `granted`, their callbacks must be invoked out of the lock.
+    void serveWaiters(GrantedWaiters& granted) {
+        while (waitersHead) {
+            auto& waiter = *waitersHead;
+            waiter.granted += popChain(waiter.indices + waiter.granted, waiter.needed - waiter.granted);
+
+            while (waiter.granted < waiter.needed && options.threadCacheSize) {
+                const auto index = steal();
+                if (index == NoSlot)
+                    break;
+
+                waiter.indices[waiter.granted++] = index;
+            }
+
+            if (waiter.granted < waiter.needed)
+                break;
+
+            dequeue(waiter);
+
+            if (waiter.keepAlive) {
+                granted.push_back(std::move(waiter.keepAlive));
+            } else {
+                waiter.cv.notify_one();
+            }
+        }
+    }
+
+    void completeGranted(const GrantedWaiters& granted) {
+        for (const auto& x : granted) {
+            if (options.statistics) {
+                counters.local().waitedTakes.fetch_add(1, std::memory_order_relaxed);
+                counters.local().waitTime.add(std::chrono::steady_clock::now() - x->since);
+            }
+
+            // Runs in the thread returning an object, often in accessor's destructor: an exception has nowhere to go,
+            // and the rest of granted requests must be completed anyway. Object of the failed callback is returned already.
+            try {
+                x->onGranted(x->slot);
+            } catch (...) {
+            }
+        }
+    }
+
+    std::function<void()> availabilityCallback;
+
+    // Called after objects are put into the free list
+    void handOver() {
+        if (waiters.load() > 0) {
+            GrantedWaiters granted;
+
+            {
+                auto locker = lock();
+                serveWaiters(granted);
+            }
+
+            completeGranted(granted);
+        }
+
+        if (availabilityCallback)
+            availabilityCallback();
+    }
+
+    // Asynchronous take. Returns nullptr if `onGranted` was invoked immediately,
+    // otherwise the queued request (which still might be granted before return).
+    std::shared_ptr<Waiter> takeAsync(const std::function<void(uint32_t)>& onGranted) {
+        const auto index = tryTake();
+
+        if (index != NoSlot) {
+            onGranted(index);
+            return {};
+        }
+
+        auto waiter = std::make_shared<Waiter>();
+        waiter->indices = &waiter->slot;
+        waiter->needed = 1;
+        waiter->onGranted = onGranted;
+        waiter->since = std::chrono::steady_clock::now();
+        waiter->keepAlive = waiter;
+
+        GrantedWaiters granted;
+
+        {
+            auto locker = lock();
+            enqueue(*waiter);
+            serveWaiters(granted); // Objects might have been returned meanwhile
+            growForQueue(locker, [&waiter]() -> bool { return !waiter->keepAlive; });
+
+            if (waiter->keepAlive)
+                kickCleaner();
+        }
+
+        completeGranted(granted);
+        return waiter;
+    }
+
+    bool cancelAsync(Waiter& waiter) {
+        std::shared_ptr<Waiter> keepAlive;
+
+        {
+            auto locker = lock();
+
+            if (!waiter.keepAlive)
+                return false;
+
+            dequeue(waiter);
+            keepAlive = std::move(waiter.keepAlive);
+        }
+
+        // Callback (and whatever it holds) is destroyed here, outside of the lock
+        return true;
+    }
+
+    // Pending asynchronous takers of a pool abandoned by its owners are never served
+    void dropAsync() {
+        GrantedWaiters dropped;
+
+        {
+            auto locker = lock();
+
+            for (auto waiter = waitersHead; waiter;) {
+                const auto next = waiter->next;
+
+                if (waiter->keepAlive) {
+                    dequeue(*waiter);
+                    dropped.push_back(std::move(waiter->keepAlive));
+                }
+
+                waiter = next;
+            }
+        }
+    }
+
+    // Thread cache
+    std::mutex magazinesMutex;
+    std::vector<MagazinePtr> magazines;
+
+    Magazine& threadMagazine() {
+        thread_local ThreadMagazines local;
+
+        if (local.lastPoolId == poolId)
+            return *local.lastMagazine;
+
+        auto& weakMagazine = local.magazines[poolId];
+        auto magazine = weakMagazine.lock();
+
+        if (!magazine) {
+            magazine = acquireMagazine();
+            weakMagazine = magazine;
+
+            // Forget magazines of dead pools
+            for (auto it = local.magazines.begin(); it != local.magazines.end();)
+                it = it->second.expired() ? local.magazines.erase(it) : std::next(it);
+        }
+
+        local.lastPoolId = poolId;
+        local.lastMagazine = magazine.get();
+        return *magazine;
+    }
+
+    MagazinePtr acquireMagazine() {
+        std::lock_guard<std::mutex> lock(magazinesMutex);
+
+        for (const auto& x : magazines) {
+            std::lock_guard<std::mutex> magazineLock(x->mutex);
+            if (x->orphaned) {
+                x->orphaned = false;
+                return x;
+            }
+        }
+
+        magazines.push_back(std::make_shared<Magazine>(options.threadCacheSize));
+        return magazines.back();
+    }
+
+    uint32_t steal() {
+        std::lock_guard<std::mutex> lock(magazinesMutex);
+
+        for (const auto& x : magazines) {
+            std::lock_guard<std::mutex> magazineLock(x->mutex);
+            if (x->count)
+                return x->items[--x->count];
+        }
+
+        return NoSlot;
+    }
+
+    // Slots management, must be called under `mutex`
+    uint32_t addSlot(void* object, uint32_t owner) {
+        uint32_t index;
+
+        if (retiredSlots.empty()) {
+            index = slots.add();
+        } else {
+            index = retiredSlots.back();
+            retiredSlots.pop_back();
+        }
+
+        auto& slot = slots[index];
+        slot.object = object;
+        slot.owner = owner;
+        return index;
+    }
+
+    uint32_t addOwner(const std::shared_ptr<void>& ptr, bool removable) {
+        if (retiredOwners.empty()) {
+            owners.push_back({ptr, removable});
+            return static_cast<uint32_t>(owners.size() - 1);
+        }
+
+        const auto index = retiredOwners.back();
+        retiredOwners.pop_back();
+        owners[index] = {ptr, removable};
+        return index;
+    }
+
+    // Elastic mode
+    std::function<std::shared_ptr<void>()> factory;
+    std::thread maintenanceThread;
+    std::mutex maintenanceMutex;
+    std::condition_variable maintenanceCv;
+    bool stopMaintenance {};
+    std::atomic_bool prewarmRequested { false };
+
+    bool isElastic() const { return options.maxSize > 0; }
+
+    size_t freeCount() const {
+        const auto t = total.load();
+        const auto u = counters.inUse.load() & ~OrphanedFlag;
+        return t > u ? t - u : 0;
+    }
+
+    // Creates a new object if limit allows. Returned slot is not in the free list.
+    uint32_t grow() {
+        auto current = total.load();
+
+        do {
+            if (current >= options.maxSize)
+                return NoSlot;
+        } while (!total.compare_exchange_weak(current, current + 1));
+
+        auto reservation = CreateScopedGuard([this](){ total--; });
+        const auto object = factory();
+
+        if (!object)
+            return NoSlot;
+
+        reservation.reset();
+        auto locker = lock();
+        return addSlot(object.get(), addOwner(object, true));
+    }
+
+    // Destroys up to `count` free objects, never going below `options.minSize`.
+    // Free objects are reserved for waiters, so nothing is destroyed while somebody waits.
+    size_t trim(size_t count) {
+        std::vector<uint32_t> kept;
+        std::vector<std::shared_ptr<void>> destroyed;
+
+        while (count && total.load() > options.minSize && !waiters.load()) {
+            const auto index = pop();
+            if (index == NoSlot)
+                break;
+
+            auto locker = lock();
+            auto& slot = slots[index];
+            auto& owner = owners[slot.owner];
+
+            // Checked under the lock: a waiter enqueued later sees decremented `total`, see `wait`
+            if (waiters.load()) {
+                kept.push_back(index);
+                break;
+            }
+
+            if (!owner.removable) {
+                kept.push_back(index);
+                continue;
+            }
+
+            destroyed.push_back(std::move(owner.ptr));
+            retiredOwners.push_back(slot.owner);
+            retiredSlots.push_back(index);
+            slot.object = nullptr;
+            total--;
+            count--;
+        }
+
+        if (!kept.empty()) {
+            pushChain(kept.data(), kept.size());
+            handOver();
+        }
+
+        // Objects are destroyed here, outside of the lock
+        return destroyed.size();
+    }
+
+    void prewarm() {
+        while (freeCount() < options.lowWatermark) {
+            const auto index = grow();
+            if (index == NoSlot)
+                break;
+
+            push(index);
+            handOver();
+        }
+    }
+
+    void requestPrewarm() {
+        if (!prewarmRequested.load() && !prewarmRequested.exchange(true)) {
+            { std::lock_guard<std::mutex> lock(maintenanceMutex); }
+            maintenanceCv.notify_one();
+        }
+    }
+
+    // Background thread: prewarm on request and periodic idle trimming.
+    // Surplus is the minimum number of free objects sampled during `idleTimeout`:
+    // these objects weren't needed during the whole period.
+    void maintenance() {
+        t_internalThreadOf = this;
+        const auto idleTimeout = options.idleTimeout;
+        const auto samplePeriod = (std::max)(idleTimeout / 4, std::chrono::milliseconds(1));
+        auto minFree = (std::numeric_limits<size_t>::max)();
+        auto windowStart = std::chrono::steady_clock::now();
+
+        std::unique_lock<std::mutex> lock(maintenanceMutex);
+
+        while (!stopMaintenance) {
+            const auto isWoken = [this]() -> bool { return stopMaintenance || prewarmRequested.load(); };
+
+            if (idleTimeout.count()) {
+                maintenanceCv.wait_for(lock, samplePeriod, isWoken);
+            } else {
+                maintenanceCv.wait(lock, isWoken);
+            }
+
+            if (stopMaintenance)
+                break;
+
+            lock.unlock();
+
+            if (prewarmRequested.exchange(false))
+                prewarm();
+
+            if (idleTimeout.count()) {
+                minFree = (std::min)(minFree, freeCount());
+
+                const auto now = std::chrono::steady_clock::now();
+                if (now - windowStart >= idleTimeout) {
+                    if (minFree > options.lowWatermark)
+                        trim(minFree - options.lowWatermark);
+
+                    minFree = (std::numeric_limits<size_t>::max)();
+                    windowStart = now;
+                }
+            }
+
+            lock.lock();
+        }
+    }
+
+    void startElastic(const std::function<std::shared_ptr<void>()>& objectFactory) {
+        factory = objectFactory;
+
+        for (size_t i = 0; i < options.minSize; i++) {
+            const auto index = grow();
+            if (index == NoSlot)
+                break;
+
+            push(index);
+        }
+
+        if (options.idleTimeout.count() || options.lowWatermark)
+            maintenanceThread = std::thread(&impl_t::maintenance, this);
+    }
+
+    void stopElastic() {
+        if (maintenanceThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(maintenanceMutex);
+                stopMaintenance = true;
+            }
+
+            maintenanceCv.notify_one();
+            maintenanceThread.join();
+        }
+    }
+
+    void append(const std::shared_ptr<void>& obj) {
+        uint32_t index;
+
+        {
+            auto locker = lock();
+            index = addSlot(obj.get(), addOwner(obj, true));
+        }
+
+        total++;
+        push(index);
+        handOver();
+    }
+
+    // Parallel append: builder threads construct objects and publish each one as soon as it's ready
+    std::mutex buildersMutex;
+    std::vector<std::thread> builders; // Guarded by `buildersMutex`
+    std::exception_ptr buildersError;  // Guarded by `buildersMutex`
+    std::atomic<bool> stopBuilders { false };
+    std::atomic<size_t> pendingAppends { 0 }; // Objects yet to be appended by builders
+
+    void appendParallel(size_t count, size_t threads, const std::function<std::shared_ptr<void>()>& factory) {
+        const auto remaining = std::make_shared<std::atomic<intmax_t>>(count);
+        pendingAppends += count;
+
+        const auto builder = [this, remaining, factory]() {
+            t_internalThreadOf = this;
+
+            while (!stopBuilders.load() && remaining->fetch_sub(1) > 0) {
+                try {
+                    append(factory()); // Counted in `total` before leaving `pendingAppends`
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(buildersMutex);
+                    if (!buildersError)
+                        buildersError = std::current_exception();
+                }
+
+                pendingAppends--;
+            }
+
+            // Cancelled: the rest won't be appended
+            const auto cancelled = remaining->exchange(0);
+            if (cancelled > 0)
+                pendingAppends -= static_cast<size_t>(cancelled);
+        };
+
+        std::lock_guard<std::mutex> lock(buildersMutex);
+
+        for (size_t i = 0; i < (std::min)(count, threads); i++)
+            builders.emplace_back(builder);
+    }
+
+    void waitBuilders() {
+        std::vector<std::thread> joining;
+        std::exception_ptr error;
+
+        {
+            std::lock_guard<std::mutex> lock(buildersMutex);
+            joining.swap(builders);
+        }
+
+        for (auto& x : joining)
+            x.join();
+
+        {
+            std::lock_guard<std::mutex> lock(buildersMutex);
+            error = std::exchange(buildersError, nullptr);
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    void stopParallelAppends() {
+        std::vector<std::thread> joining;
+        stopBuilders = true;
 
-    LockPtr lock() { return std::make_shared<std::unique_lock<std::mutex>>(mutex); }
+        {
+            std::lock_guard<std::mutex> lock(buildersMutex);
+            joining.swap(builders);
+        }
+
+        for (auto& x : joining)
+            x.join();
+    }
+
+    // Recycle hooks
+    std::function<void(void*)> onTakeHook;
+    std::function<void(void*)> onReturnHook;
+
+    // Deferred recycling: returned objects are reset by the cleaner thread
+    // and only then appear in the free list
+    std::thread cleanerThread;
+    std::mutex cleanerMutex;
+    std::condition_variable cleanerCv;
+    std::vector<uint32_t> dirty; // Guarded by `cleanerMutex`
+    bool stopCleaner {};
+
+    bool isRecycleDeferred() const { return options.recycleMode == ObjectsPoolRecycleMode::Deferred && onReturnHook; }
+
+    void setRecycleHooks(const std::function<void(void*)>& onTake, const std::function<void(void*)>& onReturn) {
+        assert(!cleanerThread.joinable() && "Recycle hooks can be set only once");
+        onTakeHook = onTake;
+        onReturnHook = onReturn;
+
+        if (isRecycleDeferred())
+            cleanerThread = std::thread(&impl_t::cleaner, this);
+    }
+
+    void deferRecycle(const uint32_t* indices, size_t count) {
+        bool wake;
+
+        {
+            std::lock_guard<std::mutex> lock(cleanerMutex);
+            dirty.insert(dirty.end(), indices, indices + count);
+            wake = dirty.size() >= options.recycleBatchSize;
+        }
+
+        if (wake || waiters.load())
+            cleanerCv.notify_one();
+    }
+
+    // Called by takers before they start waiting
+    void kickCleaner() {
+        if (!cleanerThread.joinable())
+            return;
+
+        bool wake;
+
+        {
+            std::lock_guard<std::mutex> lock(cleanerMutex);
+            wake = !dirty.empty();
+        }
+
+        if (wake)
+            cleanerCv.notify_one();
+    }
+
+    void cleaner() {
+        t_internalThreadOf = this;
+        std::vector<uint32_t> batch;
+        std::unique_lock<std::mutex> lock(cleanerMutex);
+
+        while (!stopCleaner) {
+            const auto isReady = [this]() -> bool {
+                return stopCleaner || dirty.size() >= options.recycleBatchSize || (!dirty.empty() && waiters.load());
+            };
+
+            if (!options.recycleDelay.count()) {
+                cleanerCv.wait(lock, isReady);
+            } else if (!isReady()) {
+                cleanerCv.wait_for(lock, options.recycleDelay, isReady);
+            }
+
+            if (stopCleaner)
+                break;
+
+            if (dirty.empty())
+                continue;
+
+            batch.swap(dirty);
+            lock.unlock();
+
+            for (auto index : batch)
+                onReturnHook(slots[index].object);
+
+            pushChain(batch.data(), batch.size());
+            handOver();
+            batch.clear();
+
+            lock.lock();
+        }
+    }
+
+    void stopRecycling() {
+        if (cleanerThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(cleanerMutex);
+                stopCleaner = true;
+            }
+
+            cleanerCv.notify_one();
+            cleanerThread.join();
+        }
+    }
+
+    // Take / return
+    uint32_t tryTake() {
+        // Free objects are reserved for waiters, if any
+        auto index = waiters.load() ? NoSlot : tryTakeFree();
+
+        if (index == NoSlot && isElastic())
+            index = grow();
+
+        return index;
+    }
+
+    uint32_t tryTakeFree() {
+        if (!options.threadCacheSize)
+            return pop();
+
+        auto& magazine = threadMagazine();
+
+        {
+            std::lock_guard<std::mutex> lock(magazine.mutex);
+
+            if (magazine.count) {
+                magazine.stats.hits++;
+                return magazine.items[--magazine.count];
+            }
+
+            magazine.stats.misses++;
+
+            if (const auto count = popChain(magazine.items.get(), cacheBatch)) {
+                magazine.stats.refills++;
+                magazine.count = count - 1;
+                return magazine.items[count - 1];
+            }
+        }
+
+        return steal();
+    }
+
+    // Waits for a free slot. Without deadline waits unbounded.
+    uint32_t take(const std::chrono::steady_clock::time_point* deadline = nullptr) {
+        auto index = tryTake();
+
+        if (index == NoSlot && !wait(&index, 1, deadline))
+            index = NoSlot;
+
+        return index;
+    }
+
+    // Takes `count` objects. If `all` is set, takes either all of them or none.
+    size_t tryTakeMany(uint32_t* indices, size_t count, bool all) {
+        const bool reserved = waiters.load() > 0;
+        auto taken = reserved ? 0 : popChain(indices, count);
+
+        while (taken < count) {
+            auto index = options.threadCacheSize && !reserved ? steal() : NoSlot;
+
+            if (index == NoSlot && isElastic())
+                index = grow();
+
+            if (index == NoSlot)
+                break;
+
+            indices[taken++] = index;
+        }
+
+        if (all && taken < count) {
+            if (taken) {
+                pushChain(indices, taken);
+                handOver();
+            }
+
+            return 0;
+        }
+
+        return taken;
+    }
+
+    bool takeMany(uint32_t* indices, size_t count, const std::chrono::steady_clock::time_point* deadline) {
+        return tryTakeMany(indices, count, true) || wait(indices, count, deadline);
+    }
+
+    // Elastic pool might have been trimmed after a waiter's failed attempt to grow,
+    // then nobody else would create objects for the queue. Called under `mutex` after enqueuing.
+    template<typename Predicate>
+    void growForQueue(std::unique_lock<std::mutex>& locker, Predicate isGranted) {
+        while (!isGranted() && isElastic() && total.load() < options.maxSize) {
+            locker.unlock();
+            const auto index = grow();
+
+            if (index != NoSlot) {
+                push(index);
+                handOver();
+            }
+
+            locker.lock();
+
+            if (index == NoSlot)
+                break;
+        }
+    }
+
+    // Joins the waiters queue and sleeps until it's handed `count` objects.
+    // On timeout gives back what it has collected so far.
+    bool wait(uint32_t* indices, size_t count, const std::chrono::steady_clock::time_point* deadline) {
+        Waiter waiter;
+        waiter.indices = indices;
+        waiter.needed = count;
+
+        const auto isGranted = [&waiter]() -> bool { return waiter.granted == waiter.needed; };
+        const auto waitStart = std::chrono::steady_clock::now();
+        GrantedWaiters granted;
+        auto locker = lock();
+
+        enqueue(waiter);
+        serveWaiters(granted); // Objects might have been returned meanwhile
+
+        growForQueue(locker, isGranted);
+
+        if (!isGranted()) {
+            kickCleaner();
+
+            if (deadline) {
+                waiter.cv.wait_until(locker, *deadline, isGranted);
+            } else {
+                waiter.cv.wait(locker, isGranted);
+            }
+        }
+
+        const auto result = isGranted();
+
+        if (!result) {
+            dequeue(waiter);
+
+            if (waiter.granted)
+                pushChain(indices, waiter.granted);
+
+            serveWaiters(granted);
+        }
+
+        locker.unlock();
+        completeGranted(granted);
+
+        if (options.statistics) {
+            counters.local().waitedTakes.fetch_add(1, std::memory_order_relaxed);
+            counters.local().waitTime.add(std::chrono::steady_clock::now() - waitStart);
+        }
+
+        return result;
+    }
+
+    // Accounting of objects handed out to / returned by users
+    void onTaken(uint32_t index) {
+        onTaken(&index, 1);
+    }
+
+    void onTaken(const uint32_t* indices, size_t count) {
+        const auto used = (counters.inUse.fetch_add(count) & ~OrphanedFlag) + count;
+
+        if (options.statistics) {
+            counters.local().takes.fetch_add(count, std::memory_order_relaxed);
+
+            const auto now = steadyTicks();
+            for (size_t i = 0; i < count; i++)
+                slots[indices[i]].takenAt.store(now, std::memory_order_relaxed);
+
+            auto peak = counters.peakInUse.load(std::memory_order_relaxed);
+            while (used > peak && !counters.peakInUse.compare_exchange_weak(peak, used, std::memory_order_relaxed)) { }
+        }
+
+        if (isElastic() && options.lowWatermark && freeCount() < options.lowWatermark)
+            requestPrewarm();
+
+        if (onTakeHook)
+            for (size_t i = 0; i < count; i++)
+                onTakeHook(slots[indices[i]].object);
+    }
+
+    void onTakeFailed() {
+        if (options.statistics)
+            counters.local().failedTakes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void onReturned(uint32_t index) {
+        onReturned(&index, 1);
+    }
+
+    void onReturned(const uint32_t* indices, size_t count) {
+        if (options.statistics) {
+            const auto now = steadyTicks();
+
+            for (size_t i = 0; i < count; i++) {
+                const auto takenAt = slots[indices[i]].takenAt.exchange(0, std::memory_order_relaxed);
+                counters.local().holdTime.add(std::chrono::steady_clock::duration(now - takenAt));
+            }
+        }
+
+        if (onReturnHook && !isRecycleDeferred())
+            for (size_t i = 0; i < count; i++)
+                onReturnHook(slots[indices[i]].object);
+    }
+
+    void giveBack(uint32_t index) {
+        if (options.threadCacheSize && !waiters.load()) {
+            auto& magazine = threadMagazine();
+
+            {
+                std::lock_guard<std::mutex> lock(magazine.mutex);
+
+                if (magazine.count == options.threadCacheSize) {
+                    // Spill the coldest part, keep recently returned objects
+                    pushChain(magazine.items.get(), cacheBatch);
+                    std::copy(magazine.items.get() + cacheBatch, magazine.items.get() + magazine.count, magazine.items.get());
+                    magazine.count -= cacheBatch;
+                    magazine.stats.spills++;
+                }
+
+                magazine.items[magazine.count++] = index;
+            }
+
+            // Somebody started waiting meanwhile, hand cached objects over
+            if (waiters.load()) {
+                {
+                    std::lock_guard<std::mutex> lock(magazine.mutex);
+                    pushChain(magazine.items.get(), magazine.count);
+                    magazine.count = 0;
+                    magazine.stats.spills++;
+                }
+
+                handOver();
+            } else if (availabilityCallback) {
+                availabilityCallback();
+            }
+
+            return;
+        }
+
+        push(index);
+        handOver();
+    }
 };
 
 
-ObjectsPoolBase::ObjectsPoolBase()
+ObjectsPoolBase::ObjectsPoolBase(const ObjectsPoolOptions& options)
 {
-    createImpl();
+    createImpl(options);
 }
 
 ObjectsPoolBase::~ObjectsPoolBase()
 {
+    impl().stopParallelAppends();
+    assert((impl().counters.inUse & ~OrphanedFlag) == 0 && "Pool destroyed while objects are still taken!");
+    impl().stopRecycling();
+    impl().stopElastic();
+}
+
+void ObjectsPoolBase::baseReleaseOwnership()
+{
+    impl().dropAsync();
+
+    const auto leases = impl().counters.inUse.fetch_add(OrphanedFlag);
+    assert(!(leases & OrphanedFlag));
+
+    if (!leases)
+        destroy();
+}
+
+void ObjectsPoolBase::releaseLeases(size_t count)
+{
+    // Must be the last access to the pool: it might be destroyed here
+    if (impl().counters.inUse.fetch_sub(count) == OrphanedFlag + count)
+        destroy();
+}
+
+void ObjectsPoolBase::destroy()
+{
+    // Last object may be released by user code running on an internal thread (e.g. async take callback).
+    // Destructor joins internal threads, so in this case it runs on a separate one.
+    if (t_internalThreadOf == &impl()) {
+        std::thread([this](){ delete this; }).detach();
+        return;
+    }
+
+    delete this;
+}
+
+const ObjectsPoolOptions& ObjectsPoolBase::options() const
+{
+    return impl().options;
+}
+
+size_t ObjectsPoolBase::size() const
+{
+    return impl().total.load();
 }
 
 void ObjectsPoolBase::baseAppend(const std::shared_ptr<void>& obj)
 {
-    auto lck = impl().lock();
-    impl().objects.emplace_back(ObjectContext{obj});
-    impl().available++;
-    impl().cv.notify_one();
+    impl().append(obj);
+}
+
+void ObjectsPoolBase::baseAppendParallel(size_t count, size_t threads, const std::function<std::shared_ptr<void>()>& factory)
+{
+    if (!threads)
+        threads = (std::max)(std::thread::hardware_concurrency(), 1u);
+
+    impl().appendParallel(count, threads, factory);
+}
+
+size_t ObjectsPoolBase::trim(size_t count)
+{
+    return impl().trim(count);
+}
+
+void ObjectsPoolBase::setAvailabilityCallback(const std::function<void()>& callback)
+{
+    impl().availabilityCallback = callback;
+}
+
+void ObjectsPoolBase::waitForParallelAppends()
+{
+    impl().waitBuilders();
+}
+
+void ObjectsPoolBase::baseAppendSlab(void* first, size_t stride, size_t count, const std::shared_ptr<void>& owner)
+{
+    std::vector<uint32_t> indices(count);
+
+    {
+        auto locker = impl().lock();
+        const auto ownerIndex = impl().addOwner(owner, false);
+
+        for (size_t i = 0; i < count; i++)
+            indices[i] = impl().addSlot(static_cast<unsigned char*>(first) + i * stride, ownerIndex);
+    }
+
+    impl().total += count;
+    impl().pushChain(indices.data(), count);
+    impl().handOver();
+}
+
+ObjectsPoolStats ObjectsPoolBase::stats() const
+{
+    const auto& counters = impl().counters;
+    ObjectsPoolStats result;
+
+    result.size = impl().total.load();
+    result.inUse = counters.inUse.load() & ~OrphanedFlag;
+    result.peakInUse = counters.peakInUse.load();
+
+    for (size_t i = 0; i < counters.stripeCount; i++) {
+        const auto& stripe = counters.stripes[i];
+        result.takes += stripe.takes.load();
+        result.failedTakes += stripe.failedTakes.load();
+        result.waitedTakes += stripe.waitedTakes.load();
+        result.lockContentions += stripe.lockContentions.load();
+        result.shardSteals += stripe.shardSteals.load();
+
+        const auto waitTime = stripe.waitTime.snapshot();
+        const auto holdTime = stripe.holdTime.snapshot();
+
+        for (size_t j = 0; j < ObjectsPoolHistogram::Buckets; j++) {
+            result.waitTime.counts[j] += waitTime.counts[j];
+            result.holdTime.counts[j] += holdTime.counts[j];
+        }
+    }
+
+    result.threadCache = threadCacheStats();
+
+    return result;
+}
+
+std::vector<ObjectsPoolLease> ObjectsPoolBase::longHeldLeases(std::chrono::steady_clock::duration threshold) const
+{
+    auto& self = const_cast<impl_t&>(impl());
+    std::vector<ObjectsPoolLease> result;
+
+    const auto now = steadyTicks();
+    auto locker = self.lock();
+
+    for (uint32_t i = 0; i < self.slots.size(); i++) {
+        const auto takenAt = self.slots[i].takenAt.load(std::memory_order_relaxed);
+        if (!takenAt)
+            continue;
+
+        const auto heldFor = std::chrono::steady_clock::duration(now - takenAt);
+        if (heldFor >= threshold)
+            result.push_back({i, heldFor});
+    }
+
+    return result;
+}
+
+ObjectsPoolThreadCacheStats ObjectsPoolBase::threadCacheStats() const
+{
+    auto& self = const_cast<impl_t&>(impl());
+    ObjectsPoolThreadCacheStats result;
+
+    std::lock_guard<std::mutex> lock(self.magazinesMutex);
+
+    for (const auto& x : self.magazines) {
+        std::lock_guard<std::mutex> magazineLock(x->mutex);
+        result.hits += x->stats.hits;
+        result.misses += x->stats.misses;
+        result.refills += x->stats.refills;
+        result.spills += x->stats.spills;
+    }
+
+    return result;
+}
+
+void ObjectsPoolBase::baseMakeElastic(const std::function<std::shared_ptr<void>()>& factory)
+{
+    impl().startElastic(factory);
+}
+
+ObjectsPoolBase::TakenObject ObjectsPoolBase::baseTake()
+{
+    const auto index = impl().take();
+    impl().onTaken(index);
+    return {impl().slots[index].object, index};
+}
+
+bool ObjectsPoolBase::baseTryTake(TakenObject& result)
+{
+    const auto index = impl().tryTake();
+    if (index == NoSlot) {
+        impl().onTakeFailed();
+        return false;
+    }
+
+    impl().onTaken(index);
+    result = {impl().slots[index].object, index};
+    return true;
+}
+
+bool ObjectsPoolBase::baseTakeUntil(std::chrono::steady_clock::time_point deadline, TakenObject& result)
+{
+    const auto index = impl().take(&deadline);
+    if (index == NoSlot) {
+        impl().onTakeFailed();
+        return false;
+    }
+
+    impl().onTaken(index);
+    result = {impl().slots[index].object, index};
+    return true;
 }
 
-const std::shared_ptr<void> ObjectsPoolBase::baseTake()
+void ObjectsPoolBase::baseTakeMany(size_t count, bool all, bool wait, const std::chrono::steady_clock::time_point* deadline,
+                                   std::vector<uint32_t>& slots, std::vector<void*>& objects)
 {
-    auto lck = impl().lock();
+    // Waiter collects returned objects until it has all of them: if the pool can't ever hold `count`
+    // objects, it would starve every other taker. Such requests fail immediately.
+    // Objects still being added by `appendParallel` count, they will arrive.
+    const auto target = impl().total.load() + impl().pendingAppends.load();
+    const auto limit = impl().isElastic() ? (std::max)(impl().options.maxSize, target) : target;
 
-    if (!impl().available)
-        impl().cv.wait(*lck, [this]() -> bool { return (impl().available > 0); });
+    if (wait && count > limit) {
+        assert(deadline && "takeMany: count exceeds pool size, it would wait forever");
+        slots.clear();
+        objects.clear();
+        impl().onTakeFailed();
+        return;
+    }
 
-    auto it = std::find_if(impl().objects.begin(), impl().objects.end(), [](const ObjectContext& ctx) -> bool { return !*ctx.isUsed; });
-    assert(it != impl().objects.end());
+    slots.resize(count);
 
-    *it->isUsed = true;
-    impl().available--;
+    size_t taken = 0;
 
-    return it->obj;
+    if (wait) {
+        assert(all);
+        taken = impl().takeMany(slots.data(), count, deadline) ? count : 0;
+    } else {
+        taken = impl().tryTakeMany(slots.data(), count, all);
+    }
+
+    slots.resize(taken);
+    objects.resize(taken);
+
+    if (!taken) {
+        impl().onTakeFailed();
+        return;
+    }
+
+    impl().onTaken(slots.data(), taken);
+
+    for (size_t i = 0; i < taken; i++)
+        objects[i] = impl().slots[slots[i]].object;
+}
+
+ObjectsPoolAsyncTake ObjectsPoolBase::baseTakeAsync(const std::function<void(const TakenObject&)>& callback)
+{
+    ObjectsPoolAsyncTake result;
+    result.pool = weak_from_this();
+    result.request = impl().takeAsync([this, callback](uint32_t index){
+        impl().onTaken(index);
+        callback({impl().slots[index].object, index});
+    });
+
+    return result;
+}
+
+bool ObjectsPoolAsyncTake::cancel()
+{
+    const auto master = pool.lock();
+    const auto waiter = std::static_pointer_cast<Waiter>(request);
+
+    pool.reset();
+    request.reset();
+
+    return master && waiter && master->impl().cancelAsync(*waiter);
+}
+
+void ObjectsPoolBase::baseSetRecycleHooks(const std::function<void(void*)>& onTake, const std::function<void(void*)>& onReturn)
+{
+    impl().setRecycleHooks(onTake, onReturn);
+}
+
+void ObjectsPoolBase::returnObject(uint32_t slot)
+{
+    impl().onReturned(slot);
+
+    if (impl().isRecycleDeferred()) {
+        impl().deferRecycle(&slot, 1);
+    } else {
+        impl().giveBack(slot);
+    }
+
+    releaseLeases(1);
+}
+
+void ObjectsPoolBase::returnObjects(const uint32_t* slots, size_t count)
+{
+    if (!count)
+        return;
+
+    impl().onReturned(slots, count);
+
+    if (impl().isRecycleDeferred()) {
+        impl().deferRecycle(slots, count);
+    } else {
+        impl().pushChain(slots, count);
+        impl().handOver();
+    }
+
+    releaseLeases(count);
 }
 
-void ObjectsPoolBase::returnObject(void* ptr)
+ObjectAccessorBase::ObjectAccessorBase(void* obj, uint32_t slot, ObjectsPoolBase* master)
+    : object(obj), master(master), slot(slot)
 {
-    auto lck = impl().lock();
-    auto it = std::find_if(impl().objects.begin(), impl().objects.end(), [ptr](const ObjectContext& ctx) -> bool { return (ctx.obj.get() == ptr); });
-    assert(it != impl().objects.end());
+}
 
-    *it->isUsed = false;
-    impl().available++;
-    impl().cv.notify_one();
+ObjectAccessorBase::ObjectAccessorBase(ObjectAccessorBase&& rhs) noexcept
+    : object(rhs.object), master(rhs.master), slot(rhs.slot)
+{
+    rhs.object = nullptr;
+    rhs.master = nullptr;
 }
 
-ObjectAccessorBase::ObjectAccessorBase(const std::shared_ptr<void>& obj, const std::shared_ptr<ObjectsPoolBase>& master)
-    : object(obj), master(master)
+ObjectAccessorBase& ObjectAccessorBase::operator=(ObjectAccessorBase&& rhs) noexcept
 {
+    if (this == &rhs)
+        return *this;
+
+    release();
+    object = rhs.object;
+    slot = rhs.slot;
+    master = rhs.master;
+    rhs.object = nullptr;
+    rhs.master = nullptr;
+
+    return *this;
 }
 
 ObjectAccessorBase::~ObjectAccessorBase()
 {
-    master->returnObject(object.get());
+    release();
+}
+
+void ObjectAccessorBase::release()
+{
+    if (master) {
+        master->returnObject(slot);
+        master = nullptr;
+        object = nullptr;
+    }
+}
+
+ObjectsBatchBase::ObjectsBatchBase(std::vector<uint32_t>&& slots, std::vector<void*>&& objects, ObjectsPoolBase* master)
+    : slots(std::move(slots)), objects(std::move(objects)), master(master)
+{
+}
+
+ObjectsBatchBase::ObjectsBatchBase(ObjectsBatchBase&& rhs) noexcept
+    : slots(std::move(rhs.slots)), objects(std::move(rhs.objects)), master(rhs.master)
+{
+    rhs.slots.clear();
+    rhs.objects.clear();
+    rhs.master = nullptr;
+}
+
+ObjectsBatchBase& ObjectsBatchBase::operator=(ObjectsBatchBase&& rhs) noexcept
+{
+    if (this == &rhs)
+        return *this;
+
+    release();
+    slots = std::move(rhs.slots);
+    objects = std::move(rhs.objects);
+    master = rhs.master;
+    rhs.slots.clear();
+    rhs.objects.clear();
+    rhs.master = nullptr;
+
+    return *this;
+}
+
+ObjectsBatchBase::~ObjectsBatchBase()
+{
+    release();
+}
+
+void ObjectsBatchBase::release()
+{
+    if (master) {
+        master->returnObjects(slots.data(), slots.size());
+        master = nullptr;
+    }
+
+    slots.clear();
+    objects.clear();
 }
 
 void* ObjectAccessorBase::get_internal()
 {
-    return object.get();
+    return object;
 }
 
 const void* ObjectAccessorBase::get_internal() const
 {
-    return object.get();
+    return object;
 }
@@ -0,0 +1,97 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+#include "utils-cpp/spsc_circularbuffer.h"
+#include <algorithm>
+#include <cstring>
+
+
+namespace {
+
+size_t roundCapacity(size_t capacity)
+{
+    size_t result = 1;
+    while (result < capacity)
+        result <<= 1;
+    return result;
+}
+
+} // namespace
+
+
+SpscCircularBuffer::SpscCircularBuffer(size_t capacity)
+    : m_capacity(roundCapacity(capacity)),
+      m_mask(m_capacity - 1),
+      m_data(new unsigned char[m_capacity])
+{
+}
+
+SpscCircularBuffer::~SpscCircularBuffer() = default;
+
+size_t SpscCircularBuffer::size() const
+{
+    // Head first: consumer never moves it past the tail, so a later loaded tail is not behind it
+    const auto head = m_head.load(std::memory_order_acquire);
+    const auto tail = m_tail.load(std::memory_order_acquire);
+    return tail - head;
+}
+
+size_t SpscCircularBuffer::write(const void* d, size_t bytes)
+{
+    if (bytes == 0) return 0;
+
+    const auto tail = m_tail.load(std::memory_order_relaxed);
+
+    if (m_capacity - (tail - m_cachedHead) < bytes)
+        m_cachedHead = m_head.load(std::memory_order_acquire);
+
+    const auto bytes_to_write = (std::min)(bytes, m_capacity - (tail - m_cachedHead));
+    if (bytes_to_write == 0) return 0;
+
+    const auto data = static_cast<const unsigned char*>(d);
+    const auto offset = tail & m_mask;
+    const auto size_1 = (std::min)(bytes_to_write, m_capacity - offset);
+
+    memcpy(m_data.get() + offset, data, size_1);
+    memcpy(m_data.get(), data + size_1, bytes_to_write - size_1);
+
+    m_tail.store(tail + bytes_to_write, std::memory_order_release);
+    return bytes_to_write;
+}
+
+size_t SpscCircularBuffer::read(void* data, size_t bytes, bool erase)
+{
+    const auto head = m_head.load(std::memory_order_relaxed);
+    const auto bytes_read = peek(data, bytes, head);
+
+    if (erase && bytes_read)
+        m_head.store(head + bytes_read, std::memory_order_release);
+
+    return bytes_read;
+}
+
+size_t SpscCircularBuffer::readRO(void* data, size_t bytes) const
+{
+    return peek(data, bytes, m_head.load(std::memory_order_relaxed));
+}
+
+size_t SpscCircularBuffer::peek(void* d, size_t bytes, size_t head) const
+{
+    if (bytes == 0) return 0;
+
+    if (m_cachedTail - head < bytes)
+        m_cachedTail = m_tail.load(std::memory_order_acquire);
+
+    const auto bytes_to_read = (std::min)(bytes, m_cachedTail - head);
+    if (bytes_to_read == 0) return 0;
+
+    const auto data = static_cast<unsigned char*>(d);
+    const auto offset = head & m_mask;
+    const auto size_1 = (std::min)(bytes_to_read, m_capacity - offset);
+
+    memcpy(data, m_data.get() + offset, size_1);
+    memcpy(data + size_1, m_data.get(), bytes_to_read - size_1);
+
+    return bytes_to_read;
+}
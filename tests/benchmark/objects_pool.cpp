@@ -0,0 +1,155 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+// ObjectsPool take+return under contention.
+// Counters: items_per_second (take+return pairs, all threads), take latency percentiles in ns
+// (over samples of all threads) and oversubscription (threads per pooled object).
+// Run with `--benchmark_format=json` to compare runs.
+
+#include <benchmark/benchmark.h>
+#include <utils-cpp/objects_pool.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct Payload
+{
+    char data[64] {};
+};
+
+enum Variant
+{
+    Default,
+    ThreadCache,
+    Sharded
+};
+
+ObjectsPoolPtr<Payload> pool;
+
+void hold(int64_t ns)
+{
+    if (!ns)
+        return;
+
+    const auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+    while (std::chrono::steady_clock::now() < until) { }
+}
+
+// Every 8th take is timed, so clock reads don't dominate the throughput.
+// Samples of all threads are merged, percentiles are reported by thread 0.
+class LatencySamples
+{
+public:
+    static constexpr uint64_t Period = 8;
+
+    static void reset() {
+        std::lock_guard<std::mutex> lock(merged.mutex);
+        merged.samples.clear();
+        merged.reported = 0;
+    }
+
+    bool due() { return (m_counter++ % Period) == 0; }
+    void add(std::chrono::steady_clock::duration value) { m_samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(value).count()); }
+
+    void report(benchmark::State& state) {
+        std::unique_lock<std::mutex> lock(merged.mutex);
+        merged.samples.insert(merged.samples.end(), m_samples.begin(), m_samples.end());
+        merged.reported++;
+        merged.cv.notify_all();
+
+        if (state.thread_index() != 0)
+            return;
+
+        merged.cv.wait(lock, [&state](){ return merged.reported == state.threads(); });
+
+        auto& samples = merged.samples;
+        if (samples.empty())
+            return;
+
+        std::sort(samples.begin(), samples.end());
+        const auto percentile = [&samples](double p) { return static_cast<double>(samples[static_cast<size_t>(p * (samples.size() - 1))]); };
+
+        // Set by thread 0 only, so summing over threads keeps the value
+        state.counters["p50_ns"] = percentile(0.5);
+        state.counters["p99_ns"] = percentile(0.99);
+        state.counters["p999_ns"] = percentile(0.999);
+    }
+
+private:
+    static struct Merged
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<int64_t> samples;
+        int reported {};
+    } merged;
+
+    uint64_t m_counter {};
+    std::vector<int64_t> m_samples;
+};
+
+LatencySamples::Merged LatencySamples::merged;
+
+} // namespace
+
+
+// Arguments: pool size, hold time (ns), variant
+static void benchmark_objects_pool(benchmark::State& state)
+{
+    const auto poolSize = static_cast<int>(state.range(0));
+    const auto holdNs = state.range(1);
+
+    if (state.thread_index() == 0) {
+        ObjectsPoolOptions options;
+
+        switch (static_cast<Variant>(state.range(2))) {
+            case Default: break;
+            case ThreadCache: options.threadCacheSize = 4; break;
+            case Sharded: options.shards = 0; break;
+        }
+
+        pool = ObjectsPool<Payload>::create(options, poolSize);
+        LatencySamples::reset();
+    }
+
+    LatencySamples latency;
+
+    for (auto _ : state) {
+        if (latency.due()) {
+            const auto start = std::chrono::steady_clock::now();
+            auto obj = pool->take();
+            latency.add(std::chrono::steady_clock::now() - start);
+            benchmark::DoNotOptimize(obj->data);
+            hold(holdNs);
+        } else {
+            auto obj = pool->take();
+            benchmark::DoNotOptimize(obj->data);
+            hold(holdNs);
+        }
+    }
+
+    latency.report(state);
+    state.SetItemsProcessed(state.iterations());
+    state.counters["oversubscription"] = benchmark::Counter(static_cast<double>(state.threads()) / poolSize, benchmark::Counter::kAvgThreads);
+
+    if (state.thread_index() == 0)
+        pool.reset();
+}
+
+// Uncontended: single thread
+BENCHMARK(benchmark_objects_pool)->Args({64, 0, Default})->Args({64, 0, ThreadCache})->Args({64, 0, Sharded})->UseRealTime();
+
+// Contended: enough objects for everybody, threads fight for the free list
+BENCHMARK(benchmark_objects_pool)->Args({64, 0, Default})->Args({64, 0, ThreadCache})->Args({64, 0, Sharded})->Threads(4)->Threads(8)->UseRealTime();
+
+// Exhausted: more threads than objects, takers wait for returns
+BENCHMARK(benchmark_objects_pool)->Args({4, 1000, Default})->Args({4, 1000, ThreadCache})->Args({4, 1000, Sharded})
+                                 ->Args({2, 1000, Default})->Args({2, 1000, ThreadCache})->Args({2, 1000, Sharded})->Threads(8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -4,6 +4,14 @@
 
 #include <gtest/gtest.h>
 #include <utils-cpp/circularbuffer.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifndef UTILS_CPP_OS_WINDOWS
+#include <cerrno>
+#include <unistd.h>
+#endif // UTILS_CPP_OS_WINDOWS
 
 
 namespace {
@@ -118,3 +126,357 @@ TEST(utils_cpp, CircularBuffer_Copy_Move)
     buf5.readRO(data, phraseLen);
     ASSERT_EQ(memcmp(data, phrase, phraseLen), 0);
 }
+
+TEST(utils_cpp, CircularBuffer_Spans)
+{
+    CircularBuffer buf(8);
+
+    auto writable = buf.writableSpans();
+    ASSERT_EQ(writable[0].size, 8);
+    ASSERT_EQ(writable[1].size, 0);
+
+    memcpy(writable[0].data, "abcdef", 6);
+    buf.commit(6);
+    ASSERT_EQ(buf.size(), 6);
+
+    auto readable = buf.readableSpans();
+    ASSERT_EQ(readable[0].size, 6);
+    ASSERT_EQ(readable[1].size, 0);
+    ASSERT_EQ(memcmp(readable[0].data, "abcdef", 6), 0);
+    buf.consume(4);
+
+    // Free space wraps: [6..8) and [0..4)
+    writable = buf.writableSpans();
+    ASSERT_EQ(writable[0].size, 2);
+    ASSERT_EQ(writable[1].size, 4);
+    memcpy(writable[0].data, "gh", 2);
+    memcpy(writable[1].data, "ij", 2);
+    buf.commit(4);
+    ASSERT_EQ(buf.size(), 6);
+
+    readable = buf.readableSpans();
+    ASSERT_EQ(readable[0].size, 4);
+    ASSERT_EQ(readable[1].size, 2);
+    ASSERT_EQ(memcmp(readable[0].data, "efgh", 4), 0);
+    ASSERT_EQ(memcmp(readable[1].data, "ij", 2), 0);
+
+    // Interoperates with copying API
+    char data[8] = {};
+    ASSERT_EQ(buf.readRO(data, 8), 6);
+    ASSERT_EQ(memcmp(data, "efghij", 6), 0);
+
+    buf.consume(6);
+    ASSERT_EQ(buf.size(), 0);
+    ASSERT_EQ(buf.writableSpans()[0].size, 8);
+    ASSERT_EQ(buf.readableSpans()[0].size, 0);
+}
+
+TEST(utils_cpp, CircularBuffer_Mirrored)
+{
+    CircularBufferOptions options;
+    options.mirrored = true;
+    CircularBuffer buf(100, options);
+
+#ifdef UTILS_CPP_OS_LINUX
+    ASSERT_TRUE(buf.isMirrored());
+#endif // UTILS_CPP_OS_LINUX
+
+    if (!buf.isMirrored()) {
+        ASSERT_EQ(buf.capacity(), 100);
+        return;
+    }
+
+    const auto capacity = buf.capacity();
+    ASSERT_GE(capacity, 100);
+
+    std::vector<unsigned char> data(capacity);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<unsigned char>(i * 7);
+
+    buf.fill(0, capacity - 10);
+    buf.consume(capacity - 10);
+    buf.fill(0, capacity - 20);
+    buf.consume(capacity - 20);
+
+    // Free space and data are single regions even when wrapped
+    auto writable = buf.writableSpans();
+    ASSERT_EQ(writable[0].size, capacity);
+    ASSERT_EQ(writable[1].size, 0);
+    memcpy(writable[0].data, data.data(), capacity / 2);
+    buf.commit(capacity / 2);
+    ASSERT_EQ(buf.write(data.data() + capacity / 2, capacity), capacity - capacity / 2);
+
+    auto readable = buf.readableSpans();
+    ASSERT_EQ(readable[0].size, capacity);
+    ASSERT_EQ(readable[1].size, 0);
+    ASSERT_EQ(memcmp(readable[0].data, data.data(), capacity), 0);
+
+    std::vector<unsigned char> out(capacity);
+    ASSERT_EQ(buf.read(out.data(), capacity), capacity);
+    ASSERT_EQ(out, data);
+
+    // Copy keeps the mode
+    buf.write(data.data(), 10);
+    CircularBuffer copy(buf);
+    ASSERT_TRUE(copy.isMirrored());
+    ASSERT_EQ(copy.size(), 10);
+    ASSERT_EQ(memcmp(copy.readableSpans()[0].data, data.data(), 10), 0);
+}
+
+TEST(utils_cpp, CircularBuffer_Overwrite)
+{
+    CircularBufferOptions options;
+    options.overwrite = true;
+    CircularBuffer buf(8, options);
+    char data[16] = {};
+
+    ASSERT_EQ(buf.write("abcdef", 6), 6);
+    ASSERT_EQ(buf.droppedBytes(), 0);
+
+    // Oldest bytes are discarded, data wraps
+    ASSERT_EQ(buf.write("ghijk", 5), 5);
+    ASSERT_EQ(buf.droppedBytes(), 3);
+    ASSERT_EQ(buf.size(), 8);
+    ASSERT_EQ(buf.readRO(data, 16), 8);
+    ASSERT_EQ(memcmp(data, "defghijk", 8), 0);
+
+    ASSERT_EQ(buf.fill('z', 2), 2);
+    ASSERT_EQ(buf.droppedBytes(), 5);
+    ASSERT_EQ(buf.readRO(data, 16), 8);
+    ASSERT_EQ(memcmp(data, "fghijkzz", 8), 0);
+
+    // Larger than capacity: only the tail is kept
+    ASSERT_EQ(buf.write("0123456789", 10), 10);
+    ASSERT_EQ(buf.droppedBytes(), 15);
+    ASSERT_EQ(buf.read(data, 16), 8);
+    ASSERT_EQ(memcmp(data, "23456789", 8), 0);
+
+    // Default mode still truncates
+    CircularBuffer plain(4);
+    ASSERT_EQ(plain.write("abcdef", 6), 4);
+    ASSERT_EQ(plain.droppedBytes(), 0);
+}
+
+#ifndef UTILS_CPP_OS_WINDOWS
+TEST(utils_cpp, CircularBuffer_Fd)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    CircularBuffer buf(8);
+    char data[16] = {};
+
+    // Make data and free space wrap
+    ASSERT_EQ(buf.write("xxxxxx", 6), 6);
+    ASSERT_EQ(buf.read(data, 6), 6);
+    ASSERT_EQ(buf.write("ab", 2), 2);
+
+    ASSERT_EQ(write(fds[1], "0123456789", 10), 10);
+    ASSERT_EQ(buf.readFromFd(fds[0], 3), 3);
+    ASSERT_EQ(buf.readFromFd(fds[0]), 3);
+    errno = 0;
+    ASSERT_EQ(buf.readFromFd(fds[0]), -1); // Full, not EOF
+    ASSERT_EQ(errno, ENOBUFS);
+    ASSERT_EQ(buf.readRO(data, 16), 8);
+    ASSERT_EQ(memcmp(data, "ab012345", 8), 0);
+
+    ASSERT_EQ(buf.writeToFd(fds[1], 5), 5);
+    ASSERT_EQ(buf.writeToFd(fds[1]), 3);
+    ASSERT_EQ(buf.writeToFd(fds[1]), 0); // Empty
+    ASSERT_EQ(buf.size(), 0);
+
+    ASSERT_EQ(read(fds[0], data, 16), 12);
+    ASSERT_EQ(memcmp(data, "6789ab012345", 12), 0);
+
+    // EOF and error
+    close(fds[1]);
+    ASSERT_EQ(buf.readFromFd(fds[0]), 0);
+    close(fds[0]);
+    ASSERT_EQ(buf.readFromFd(fds[0]), -1);
+
+    // Growable buffer grows instead of reporting full
+    ASSERT_EQ(pipe(fds), 0);
+    CircularBufferOptions options;
+    options.maxCapacity = 16;
+    CircularBuffer growable(4, options);
+
+    ASSERT_EQ(write(fds[1], "0123456789", 10), 10);
+    ASSERT_EQ(growable.readFromFd(fds[0]), 4);
+    ASSERT_EQ(growable.readFromFd(fds[0]), 4);
+    ASSERT_EQ(growable.capacity(), 8);
+    ASSERT_EQ(growable.readFromFd(fds[0]), 2);
+    ASSERT_EQ(growable.read(data, 16), 10);
+    ASSERT_EQ(memcmp(data, "0123456789", 10), 0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif // UTILS_CPP_OS_WINDOWS
+
+TEST(utils_cpp, CircularBuffer_Growable)
+{
+    CircularBufferOptions options;
+    options.maxCapacity = 32;
+    options.shrinkAfterReads = 2;
+    CircularBuffer buf(4, options);
+    char data[64] = {};
+
+    // Wrap, then grow: contents are kept in order
+    ASSERT_EQ(buf.write("abc", 3), 3);
+    ASSERT_EQ(buf.read(data, 2), 2);
+    ASSERT_EQ(buf.write("def", 3), 3);
+    ASSERT_EQ(buf.capacity(), 4);
+    ASSERT_EQ(buf.write("ghi", 3), 3);
+    ASSERT_EQ(buf.capacity(), 8);
+    ASSERT_EQ(buf.readRO(data, 64), 7);
+    ASSERT_EQ(memcmp(data, "cdefghi", 7), 0);
+
+    // Large write grows at once, limited by maximum
+    ASSERT_EQ(buf.write("0123456789", 10), 10);
+    ASSERT_EQ(buf.capacity(), 17);
+    ASSERT_EQ(buf.write("0123456789abcdefghij", 20), 15);
+    ASSERT_EQ(buf.capacity(), 32);
+    ASSERT_EQ(buf.size(), 32);
+
+    // Shrink after low occupancy
+    ASSERT_EQ(buf.read(data, 26), 26);
+    ASSERT_EQ(buf.capacity(), 32);
+    ASSERT_EQ(buf.read(data, 1), 1);
+    ASSERT_EQ(buf.capacity(), 16);
+    ASSERT_EQ(buf.read(data, 64), 5);
+    ASSERT_EQ(memcmp(data, "abcde", 5), 0);
+
+    buf.consume(0);
+    buf.consume(0);
+    buf.consume(0);
+    buf.consume(0);
+    ASSERT_EQ(buf.capacity(), 4);
+
+    // Fixed size by default
+    CircularBuffer plain(4);
+    ASSERT_EQ(plain.write("abcdef", 6), 4);
+    ASSERT_EQ(plain.capacity(), 4);
+}
+
+TEST(utils_cpp, CircularBuffer_Find)
+{
+    CircularBuffer buf(8);
+    char data[8] = {};
+
+    ASSERT_FALSE(buf.find('a'));
+    ASSERT_FALSE(buf.find("ab", 2));
+
+    // Data wraps: "xy\r" | "\nab\r\n"
+    ASSERT_EQ(buf.write("-----", 5), 5);
+    ASSERT_EQ(buf.read(data, 5), 5);
+    ASSERT_EQ(buf.write("xy\r\nab\r\n", 8), 8);
+
+    ASSERT_EQ(buf.find('x'), 0);
+    ASSERT_EQ(buf.find('b'), 5);
+    ASSERT_EQ(buf.find('\r', 3), 6);
+    ASSERT_FALSE(buf.find('z'));
+    ASSERT_FALSE(buf.find('x', 1));
+    ASSERT_FALSE(buf.find('x', 100));
+
+    // Straddles the wrap point
+    ASSERT_EQ(buf.find("\r\n", 2), 2);
+    ASSERT_EQ(buf.find("\r\n", 2, 3), 6);
+    ASSERT_EQ(buf.find("y\r\na", 4), 1);
+    ASSERT_EQ(buf.find("xy\r\nab\r\n", 8), 0);
+    ASSERT_FALSE(buf.find("\r\n\r", 3));
+    ASSERT_FALSE(buf.find("xy\r\nab\r\n!", 9));
+    ASSERT_EQ(buf.find("", 0, 4), 4);
+}
+
+TEST(utils_cpp, CircularBuffer_Storage)
+{
+    const auto check = [](CircularBuffer& buf) {
+        char data[16] = {};
+        ASSERT_EQ(buf.write("abcdefghij", 10), 10);
+        ASSERT_EQ(buf.read(data, 6), 6);
+        ASSERT_EQ(buf.write("klmnopqr", 8), 8);
+        ASSERT_EQ(buf.read(data, 16), 12);
+        ASSERT_EQ(memcmp(data, "ghijklmnopqr", 12), 0);
+    };
+
+    // Aligned, copied with the same policy
+    {
+        CircularBufferOptions options;
+        options.alignment = 4096;
+        CircularBuffer buf(16, options);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(buf.writableSpans()[0].data) % 4096, 0);
+        check(buf);
+
+        CircularBuffer copy(buf);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(copy.writableSpans()[0].data) % 4096, 0);
+        check(copy);
+    }
+
+    // User allocator, also used on growth
+    {
+        int allocated = 0;
+        int deallocated = 0;
+
+        CircularBufferOptions options;
+        options.maxCapacity = 64;
+        options.allocate = [&](size_t size) { allocated++; return ::operator new(size); };
+        options.deallocate = [&](void* data, size_t) { deallocated++; ::operator delete(data); };
+
+        {
+            CircularBuffer buf(16, options);
+            ASSERT_EQ(allocated, 1);
+            check(buf);
+            ASSERT_EQ(buf.write("0123456789abcdefghij", 20), 20);
+            ASSERT_EQ(allocated, 2);
+            ASSERT_EQ(deallocated, 1);
+        }
+
+        ASSERT_EQ(deallocated, 2);
+
+        // Allocator moves together with storage
+        {
+            CircularBuffer buf(16, options);
+            CircularBuffer moved(std::move(buf));
+            CircularBuffer assigned(4);
+            assigned = std::move(moved);
+            check(assigned);
+        }
+
+        ASSERT_EQ(allocated, 3);
+        ASSERT_EQ(deallocated, 3);
+    }
+
+    // Huge pages and mlock are best effort, storage works in any case
+    {
+        CircularBufferOptions options;
+        options.hugePages = CircularBufferOptions::HugePages::Transparent;
+        options.lock = true;
+        CircularBuffer buf(16, options);
+        check(buf);
+
+        options.hugePages = CircularBufferOptions::HugePages::Explicit;
+        CircularBuffer explicitHuge(16, options);
+        check(explicitHuge);
+    }
+}
+
+TEST(utils_cpp, CircularBuffer_AssignOptions)
+{
+    CircularBufferOptions options;
+    options.overwrite = true;
+
+    // Options are adopted regardless of capacity
+    CircularBuffer overwriting(8, options);
+    CircularBuffer plain(8);
+    ASSERT_EQ(plain.write("abc", 3), 3);
+
+    overwriting = plain;
+    ASSERT_FALSE(overwriting.options().overwrite);
+    ASSERT_EQ(overwriting.size(), 3);
+    ASSERT_EQ(overwriting.write("0123456789", 10), 5);
+
+    CircularBuffer other(8);
+    other = CircularBuffer(8, options);
+    ASSERT_TRUE(other.options().overwrite);
+    ASSERT_EQ(other.write("0123456789", 10), 10);
+}
@@ -0,0 +1,998 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+#include <gtest/gtest.h>
+#include <utils-cpp/objects_pool.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+struct PooledItem
+{
+    PooledItem(int value = 0): value(value) {}
+
+    int value;
+    std::atomic_int users { 0 };
+};
+
+} // namespace
+
+
+TEST(utils_cpp, ObjectsPool_Basic)
+{
+    auto pool = ObjectsPool<std::string>::create(3, "abc");
+
+    std::set<std::string*> seen;
+
+    {
+        auto a = pool->take();
+        auto b = pool->take();
+        auto c = pool->take();
+
+        ASSERT_EQ(*a, "abc");
+        ASSERT_EQ(b->size(), 3);
+        ASSERT_EQ(c.ref(), "abc");
+
+        seen.insert(a.get());
+        seen.insert(b.get());
+        seen.insert(c.get());
+        ASSERT_EQ(seen.size(), 3);
+    }
+
+    // Returned objects are reused
+    for (int i = 0; i < 10; i++) {
+        auto a = pool->take();
+        ASSERT_EQ(seen.count(a.get()), 1);
+    }
+}
+
+TEST(utils_cpp, ObjectsPool_Append)
+{
+    auto pool = ObjectsPool<PooledItem>::create(0);
+    pool->append(new PooledItem(1));
+    pool->append(40, 2);
+
+    std::vector<ObjectAccessor<PooledItem>*> accessors;
+    int sum = 0;
+
+    for (int i = 0; i < 41; i++) {
+        accessors.push_back(new ObjectAccessor<PooledItem>(pool->take()));
+        sum += accessors.back()->ref().value;
+    }
+
+    ASSERT_EQ(sum, 81);
+
+    for (auto x : accessors)
+        delete x;
+}
+
+TEST(utils_cpp, ObjectsPool_WaitForReturn)
+{
+    auto pool = ObjectsPool<PooledItem>::create(1);
+    std::atomic_bool taken { false };
+
+    std::unique_ptr<ObjectAccessor<PooledItem>> first(new ObjectAccessor<PooledItem>(pool->take()));
+
+    std::thread thread([&](){
+        auto second = pool->take();
+        taken = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_FALSE(taken);
+
+    first.reset();
+    thread.join();
+    ASSERT_TRUE(taken);
+}
+
+TEST(utils_cpp, ObjectsPool_Concurrency)
+{
+    constexpr int Threads = 8;
+    constexpr int Iterations = 20000;
+
+    auto pool = ObjectsPool<PooledItem>::create(3);
+    std::atomic_int errors { 0 };
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < Threads; t++) {
+        threads.emplace_back([&](){
+            for (int i = 0; i < Iterations; i++) {
+                auto obj = pool->take();
+                if (obj->users.fetch_add(1) != 0)
+                    errors++;
+                obj->value++;
+                obj->users.fetch_sub(1);
+            }
+        });
+    }
+
+    for (auto& x : threads)
+        x.join();
+
+    ASSERT_EQ(errors, 0);
+
+    auto a = pool->take();
+    auto b = pool->take();
+    auto c = pool->take();
+    ASSERT_EQ(a->value + b->value + c->value, Threads * Iterations);
+}
+
+TEST(utils_cpp, ObjectsPool_WaitersFifo)
+{
+    constexpr int Waiters = 4;
+
+    auto pool = ObjectsPool<PooledItem>::create(1);
+    std::unique_ptr<ObjectAccessor<PooledItem>> first(new ObjectAccessor<PooledItem>(pool->take()));
+
+    std::mutex orderMutex;
+    std::vector<int> order;
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < Waiters; i++) {
+        threads.emplace_back([&, i](){
+            auto obj = pool->take();
+            std::lock_guard<std::mutex> lock(orderMutex);
+            order.push_back(i);
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    first.reset();
+
+    // Returned object is reserved for the waiters
+    for (int i = 0; i < 100; i++) {
+        if (auto obj = pool->tryTake()) {
+            std::lock_guard<std::mutex> lock(orderMutex);
+            ASSERT_EQ(order.size(), Waiters);
+        }
+    }
+
+    for (auto& x : threads)
+        x.join();
+
+    ASSERT_EQ(order, std::vector<int>({0, 1, 2, 3}));
+}
+
+TEST(utils_cpp, ObjectsPool_TakeMany_MoreThanSize)
+{
+    auto pool = ObjectsPool<PooledItem>::create(2);
+
+    // Can't be satisfied ever: fails at once instead of holding the whole pool until deadline
+    const auto start = std::chrono::steady_clock::now();
+    ASSERT_FALSE(pool->takeManyUntil(3, std::chrono::steady_clock::now() + std::chrono::seconds(2)));
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+    auto a = pool->takeFor(std::chrono::milliseconds(500));
+    auto b = pool->takeFor(std::chrono::milliseconds(500));
+    ASSERT_TRUE(a);
+    ASSERT_TRUE(b);
+}
+
+TEST(utils_cpp, ObjectsPool_ThreadCache)
+{
+    ObjectsPoolOptions options;
+    options.threadCacheSize = 4;
+    auto pool = ObjectsPool<PooledItem>::create(options, 8);
+
+    for (int i = 0; i < 100; i++)
+        auto obj = pool->take();
+
+    auto stats = pool->threadCacheStats();
+    ASSERT_EQ(stats.misses, 1);
+    ASSERT_EQ(stats.refills, 1);
+    ASSERT_EQ(stats.hits, 99);
+    ASSERT_EQ(stats.spills, 0);
+
+    // Objects cached by one thread are still available to others
+    std::vector<std::unique_ptr<ObjectAccessor<PooledItem>>> accessors;
+    std::thread([&](){
+        for (int i = 0; i < 8; i++)
+            accessors.emplace_back(new ObjectAccessor<PooledItem>(pool->take()));
+    }).join();
+
+    accessors.clear();
+    stats = pool->threadCacheStats();
+    ASSERT_GE(stats.spills, 1);
+}
+
+TEST(utils_cpp, ObjectsPool_ThreadCache_Concurrency)
+{
+    constexpr int Threads = 8;
+    constexpr int Iterations = 20000;
+
+    ObjectsPoolOptions options;
+    options.threadCacheSize = 2;
+    auto pool = ObjectsPool<PooledItem>::create(options, 5);
+    std::atomic_int errors { 0 };
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < Threads; t++) {
+        threads.emplace_back([&](){
+            for (int i = 0; i < Iterations; i++) {
+                auto obj = pool->take();
+                if (obj->users.fetch_add(1) != 0)
+                    errors++;
+                obj->value++;
+                obj->users.fetch_sub(1);
+            }
+        });
+    }
+
+    for (auto& x : threads)
+        x.join();
+
+    ASSERT_EQ(errors, 0);
+
+    std::vector<std::unique_ptr<ObjectAccessor<PooledItem>>> accessors;
+    int sum = 0;
+
+    for (int i = 0; i < 5; i++) {
+        accessors.emplace_back(new ObjectAccessor<PooledItem>(pool->take()));
+        sum += accessors.back()->ref().value;
+    }
+
+    ASSERT_EQ(sum, Threads * Iterations);
+}
+
+TEST(utils_cpp, ObjectsPool_Move)
+{
+    auto pool = ObjectsPool<PooledItem>::create(2);
+
+    auto a = pool->take();
+    auto b = pool->take();
+    ASSERT_FALSE(pool->tryTake());
+
+    ObjectAccessor<PooledItem> c(std::move(a));
+    ASSERT_FALSE(pool->tryTake());
+
+    c = std::move(b); // Object previously held by `c` is returned
+    auto d = pool->tryTake();
+    ASSERT_TRUE(d);
+    ASSERT_FALSE(pool->tryTake());
+}
+
+TEST(utils_cpp, ObjectsPool_TryTake)
+{
+    auto pool = ObjectsPool<PooledItem>::create(1, 5);
+
+    auto a = pool->tryTake();
+    ASSERT_TRUE(a);
+    ASSERT_EQ((*a)->value, 5);
+
+    ASSERT_FALSE(pool->tryTake());
+
+    a.reset();
+    ASSERT_TRUE(pool->tryTake());
+}
+
+TEST(utils_cpp, ObjectsPool_TakeFor)
+{
+    auto pool = ObjectsPool<PooledItem>::create(1);
+    auto a = pool->take();
+
+    const auto start = std::chrono::steady_clock::now();
+    ASSERT_FALSE(pool->takeFor(std::chrono::milliseconds(50)));
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+
+    ASSERT_FALSE(pool->takeUntil(std::chrono::system_clock::now() + std::chrono::milliseconds(10)));
+
+    std::thread thread([&](){
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        auto temp = std::move(a);
+    });
+
+    ASSERT_TRUE(pool->takeUntil(std::chrono::steady_clock::now() + std::chrono::seconds(10)));
+    thread.join();
+}
+
+TEST(utils_cpp, ObjectsPool_Slab)
+{
+    static std::atomic_int instances { 0 };
+
+    struct Item
+    {
+        Item(int value): value(value) { instances++; }
+        ~Item() { instances--; }
+        int value;
+    };
+
+    {
+        ObjectsPoolOptions options;
+        options.storage = ObjectsPoolStorage::Slab;
+        auto pool = ObjectsPool<Item>::create(options, 10, 7);
+        ASSERT_EQ(instances, 10);
+
+        std::vector<std::unique_ptr<ObjectAccessor<Item>>> accessors;
+        std::set<Item*> addresses;
+
+        for (int i = 0; i < 10; i++) {
+            accessors.emplace_back(new ObjectAccessor<Item>(pool->take()));
+            ASSERT_EQ(accessors.back()->ref().value, 7);
+            addresses.insert(accessors.back()->get());
+        }
+
+        // All objects are in a single contiguous cache-line-aligned array
+        ASSERT_EQ(addresses.size(), 10);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(*addresses.begin()) % 64, 0);
+        ASSERT_EQ(*addresses.rbegin() - *addresses.begin(), 9);
+
+        ASSERT_FALSE(pool->tryTake());
+        pool->append(2, 8);
+        ASSERT_EQ(instances, 12);
+        ASSERT_EQ(pool->take()->value, 8);
+    }
+
+    ASSERT_EQ(instances, 0);
+}
+
+TEST(utils_cpp, ObjectsPool_Elastic_Grow)
+{
+    ObjectsPoolOptions options;
+    options.minSize = 1;
+    options.maxSize = 3;
+
+    std::atomic_int created { 0 };
+    auto pool = ObjectsPool<PooledItem>::createElastic(options, [&](){ return std::make_unique<PooledItem>(++created); });
+    ASSERT_EQ(pool->size(), 1);
+
+    auto a = pool->take();
+    auto b = pool->take();
+    auto c = pool->tryTake();
+    ASSERT_TRUE(c);
+    ASSERT_EQ(pool->size(), 3);
+    ASSERT_EQ(created, 3);
+
+    // Limit reached
+    ASSERT_FALSE(pool->tryTake());
+    ASSERT_FALSE(pool->takeFor(std::chrono::milliseconds(10)));
+    ASSERT_EQ(pool->size(), 3);
+}
+
+TEST(utils_cpp, ObjectsPool_Elastic_FactoryRefuses)
+{
+    ObjectsPoolOptions options;
+    options.maxSize = 10;
+
+    bool allow = false;
+    auto pool = ObjectsPool<PooledItem>::createElastic(options, [&](){ return allow ? std::make_unique<PooledItem>() : nullptr; });
+    ASSERT_EQ(pool->size(), 0);
+    ASSERT_FALSE(pool->tryTake());
+    ASSERT_EQ(pool->size(), 0);
+
+    allow = true;
+    ASSERT_TRUE(pool->tryTake());
+    ASSERT_EQ(pool->size(), 1);
+}
+
+TEST(utils_cpp, ObjectsPool_Elastic_Shrink)
+{
+    ObjectsPoolOptions options;
+    options.minSize = 2;
+    options.maxSize = 10;
+    options.idleTimeout = std::chrono::milliseconds(20);
+
+    auto pool = ObjectsPool<PooledItem>::createElastic(options, [](){ return std::make_unique<PooledItem>(); });
+
+    {
+        std::vector<std::unique_ptr<ObjectAccessor<PooledItem>>> accessors;
+        for (int i = 0; i < 8; i++)
+            accessors.emplace_back(new ObjectAccessor<PooledItem>(pool->take()));
+
+        ASSERT_EQ(pool->size(), 8);
+    }
+
+    auto keep = pool->take();
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (pool->size() > 2 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    ASSERT_EQ(pool->size(), 2);
+    ASSERT_TRUE(pool->tryTake());
+}
+
+TEST(utils_cpp, ObjectsPool_Elastic_TrimWithWaiters)
+{
+    ObjectsPoolOptions options;
+    options.maxSize = 1;
+    options.idleTimeout = std::chrono::milliseconds(1);
+
+    auto pool = ObjectsPool<PooledItem>::createElastic(options, [](){ return std::make_unique<PooledItem>(); });
+
+    // Waiter queued while the only object is returned and trimmed concurrently
+    auto a = std::make_unique<ObjectAccessor<PooledItem>>(pool->take());
+    std::atomic_bool taken { false };
+
+    std::thread waiter([&](){
+        taken = pool->takeFor(std::chrono::seconds(5)).has_value();
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_EQ(pool->trim(1), 0); // Nothing is free
+    a.reset();
+    waiter.join();
+    ASSERT_TRUE(taken);
+
+    // Takers racing with trimming (both explicit and idle) are never left behind
+    std::atomic_bool stop { false };
+    std::atomic_int failed { 0 };
+
+    std::thread trimmer([&](){
+        while (!stop)
+            pool->trim(1);
+    });
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 3; i++) {
+        threads.emplace_back([&](){
+            for (int j = 0; j < 300; j++) {
+                if (!pool->takeFor(std::chrono::seconds(5)))
+                    failed++;
+            }
+        });
+    }
+
+    for (auto& x : threads)
+        x.join();
+
+    stop = true;
+    trimmer.join();
+    ASSERT_EQ(failed, 0);
+    ASSERT_LE(pool->size(), 1);
+}
+
+TEST(utils_cpp, ObjectsPool_Elastic_Prewarm)
+{
+    ObjectsPoolOptions options;
+    options.maxSize = 10;
+    options.lowWatermark = 3;
+
+    auto pool = ObjectsPool<PooledItem>::createElastic(options, [](){ return std::make_unique<PooledItem>(); });
+    auto a = pool->take();
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (pool->size() < 4 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    ASSERT_EQ(pool->size(), 4);
+}
+
+TEST(utils_cpp, ObjectsPool_Stats)
+{
+    auto pool = ObjectsPool<PooledItem>::create(2);
+
+    {
+        auto a = pool->take();
+        auto b = pool->take();
+        ASSERT_FALSE(pool->tryTake());
+
+        const auto stats = pool->stats();
+        ASSERT_EQ(stats.size, 2);
+        ASSERT_EQ(stats.inUse, 2);
+        ASSERT_EQ(stats.peakInUse, 2);
+        ASSERT_EQ(stats.takes, 2);
+        ASSERT_EQ(stats.failedTakes, 1);
+        ASSERT_EQ(stats.waitedTakes, 0);
+        ASSERT_EQ(stats.holdTime.total(), 0);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        auto c = pool->longHeldLeases(std::chrono::milliseconds(20));
+        ASSERT_EQ(c.size(), 2);
+        ASSERT_GE(c[0].heldFor, std::chrono::milliseconds(20));
+
+        ASSERT_FALSE(pool->takeFor(std::chrono::milliseconds(5)));
+    }
+
+    auto a = pool->take();
+
+    const auto stats = pool->stats();
+    ASSERT_EQ(stats.inUse, 1);
+    ASSERT_EQ(stats.peakInUse, 2);
+    ASSERT_EQ(stats.takes, 3);
+    ASSERT_EQ(stats.failedTakes, 2);
+    ASSERT_EQ(stats.waitedTakes, 1);
+    ASSERT_EQ(stats.waitTime.total(), 1);
+    ASSERT_EQ(stats.holdTime.total(), 2);
+
+    // Both objects were held for >= 30ms: bucket [2^15, 2^16) us or later
+    uint64_t longHolds = 0;
+    for (size_t i = ObjectsPoolHistogram::bucketOf(std::chrono::milliseconds(30)); i < ObjectsPoolHistogram::Buckets; i++)
+        longHolds += stats.holdTime.counts[i];
+    ASSERT_EQ(longHolds, 2);
+
+    ASSERT_TRUE(pool->longHeldLeases(std::chrono::hours(1)).empty());
+}
+
+TEST(utils_cpp, ObjectsPool_Histogram)
+{
+    ASSERT_EQ(ObjectsPoolHistogram::bucketOf(std::chrono::nanoseconds(999)), 0);
+    ASSERT_EQ(ObjectsPoolHistogram::bucketOf(std::chrono::microseconds(1)), 1);
+    ASSERT_EQ(ObjectsPoolHistogram::bucketOf(std::chrono::microseconds(3)), 2);
+    ASSERT_EQ(ObjectsPoolHistogram::bucketOf(std::chrono::microseconds(4)), 3);
+    ASSERT_EQ(ObjectsPoolHistogram::bucketOf(std::chrono::hours(1000)), ObjectsPoolHistogram::Buckets - 1);
+    ASSERT_EQ(ObjectsPoolHistogram::upperBound(3), std::chrono::microseconds(8));
+}
+
+TEST(utils_cpp, ObjectsPool_Batch)
+{
+    auto pool = ObjectsPool<PooledItem>::create(5);
+
+    {
+        auto batch = pool->takeMany(3);
+        ASSERT_EQ(batch.size(), 3);
+        batch[0].value = 1;
+        batch[1].value = 2;
+        batch[2].value = 3;
+
+        ASSERT_FALSE(pool->tryTakeMany(3));
+        ASSERT_EQ(pool->stats().inUse, 3);
+
+        auto rest = pool->takeUpTo(10);
+        ASSERT_EQ(rest.size(), 2);
+        ASSERT_TRUE(pool->takeUpTo(1).empty());
+        ASSERT_FALSE(pool->takeManyUntil(1, std::chrono::steady_clock::now() + std::chrono::milliseconds(5)));
+
+        rest.release();
+        ASSERT_EQ(pool->stats().inUse, 3);
+        ASSERT_TRUE(pool->tryTakeMany(2));
+    }
+
+    ASSERT_EQ(pool->stats().inUse, 0);
+
+    auto all = pool->tryTakeMany(5);
+    ASSERT_TRUE(all);
+
+    int sum = 0;
+    for (size_t i = 0; i < all->size(); i++)
+        sum += (*all)[i].value;
+    ASSERT_EQ(sum, 6);
+}
+
+TEST(utils_cpp, ObjectsPool_Batch_Wait)
+{
+    auto pool = ObjectsPool<PooledItem>::create(4);
+    auto a = pool->take();
+    auto b = pool->take();
+    std::atomic_bool done { false };
+
+    std::thread thread([&](){
+        auto batch = pool->takeMany(4);
+        done = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    { auto temp = std::move(a); }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_FALSE(done);
+
+    { auto temp = std::move(b); }
+    thread.join();
+    ASSERT_TRUE(done);
+    ASSERT_EQ(pool->stats().inUse, 0);
+}
+
+TEST(utils_cpp, ObjectsPool_Batch_Concurrency)
+{
+    constexpr int Threads = 6;
+    constexpr int Iterations = 5000;
+
+    auto pool = ObjectsPool<PooledItem>::create(6);
+    std::atomic_int errors { 0 };
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < Threads; t++) {
+        threads.emplace_back([&, t](){
+            for (int i = 0; i < Iterations; i++) {
+                if (t % 2) {
+                    auto batch = pool->takeMany(3);
+                    for (size_t j = 0; j < batch.size(); j++)
+                        if (batch[j].users.fetch_add(1) != 0) errors++;
+                    for (size_t j = 0; j < batch.size(); j++)
+                        batch[j].users.fetch_sub(1);
+                } else {
+                    auto obj = pool->take();
+                    if (obj->users.fetch_add(1) != 0) errors++;
+                    obj->users.fetch_sub(1);
+                }
+            }
+        });
+    }
+
+    for (auto& x : threads)
+        x.join();
+
+    ASSERT_EQ(errors, 0);
+    ASSERT_EQ(pool->stats().inUse, 0);
+    ASSERT_TRUE(pool->tryTakeMany(6));
+}
+
+TEST(utils_cpp, ObjectsPool_AccessorOutlivesPool)
+{
+    static std::atomic_int instances { 0 };
+
+    struct Item
+    {
+        Item() { instances++; }
+        ~Item() { instances--; }
+    };
+
+    ASSERT_EQ(sizeof(ObjectAccessor<Item>), sizeof(void*) * 3);
+
+    auto pool = ObjectsPool<Item>::create(3);
+    auto a = pool->take();
+    auto batch = pool->takeMany(2);
+    pool.reset();
+
+    // Pool is kept alive by outstanding objects
+    ASSERT_EQ(instances, 3);
+    { auto temp = std::move(a); }
+    ASSERT_EQ(instances, 3);
+    batch.release();
+    ASSERT_EQ(instances, 0);
+
+    // Without outstanding objects pool dies immediately
+    pool = ObjectsPool<Item>::create(3);
+    ASSERT_EQ(instances, 3);
+    { auto temp = pool->take(); }
+    pool.reset();
+    ASSERT_EQ(instances, 0);
+}
+
+TEST(utils_cpp, ObjectsPool_RecycleHooks_Inline)
+{
+    auto pool = ObjectsPool<PooledItem>::create(1);
+    int takes = 0;
+    pool->setRecycleHooks([&](PooledItem&){ takes++; }, [](PooledItem& x){ x.value = 0; });
+
+    {
+        auto a = pool->take();
+        ASSERT_EQ(takes, 1);
+        a->value = 10;
+    }
+
+    auto a = pool->take();
+    ASSERT_EQ(takes, 2);
+    ASSERT_EQ(a->value, 0);
+}
+
+TEST(utils_cpp, ObjectsPool_RecycleHooks_Deferred)
+{
+    ObjectsPoolOptions options;
+    options.recycleMode = ObjectsPoolRecycleMode::Deferred;
+    options.recycleBatchSize = 4;
+    options.recycleDelay = std::chrono::milliseconds(0);
+
+    auto pool = ObjectsPool<PooledItem>::create(options, 8);
+    std::atomic<std::thread::id> cleanerThreadId;
+    pool->setRecycleHooks(nullptr, [&](PooledItem& x){
+        x.value = 0;
+        cleanerThreadId = std::this_thread::get_id();
+    });
+
+    // Dirty objects aren't handed out
+    for (int i = 0; i < 3; i++) {
+        auto a = pool->take();
+        ASSERT_EQ(a->value, 0);
+        a->value = 1;
+    }
+
+    auto batch = pool->takeUpTo(8);
+    ASSERT_EQ(batch.size(), 5);
+    for (size_t i = 0; i < batch.size(); i++)
+        ASSERT_EQ(batch[i].value, 0);
+    batch.release();
+
+    // Waiter forces cleaning of collected objects
+    auto a = pool->takeFor(std::chrono::seconds(10));
+    ASSERT_TRUE(a);
+    ASSERT_EQ((*a)->value, 0);
+    ASSERT_NE(cleanerThreadId.load(), std::this_thread::get_id());
+}
+
+TEST(utils_cpp, ObjectsPool_RecycleHooks_Deferred_Delay)
+{
+    ObjectsPoolOptions options;
+    options.recycleMode = ObjectsPoolRecycleMode::Deferred;
+    options.recycleBatchSize = 100;
+    options.recycleDelay = std::chrono::milliseconds(5);
+
+    auto pool = ObjectsPool<PooledItem>::create(options, 2);
+    std::atomic_int resets { 0 };
+    pool->setRecycleHooks(nullptr, [&](PooledItem&){ resets++; });
+
+    { auto a = pool->take(); }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!resets && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    ASSERT_EQ(resets, 1);
+    ASSERT_EQ(pool->takeUpTo(2).size(), 2);
+}
+
+TEST(utils_cpp, ObjectsPool_Sharded)
+{
+    ObjectsPoolOptions options;
+    options.shards = 4;
+    auto pool = ObjectsPool<PooledItem>::create(options, 3);
+
+    // Objects returned by another thread land in its shard, but are still reachable
+    std::thread([&](){
+        auto a = pool->take();
+        auto b = pool->take();
+        auto c = pool->take();
+        ASSERT_FALSE(pool->tryTake());
+    }).join();
+
+    auto batch = pool->tryTakeMany(3);
+    ASSERT_TRUE(batch);
+    ASSERT_FALSE(pool->tryTake());
+}
+
+TEST(utils_cpp, ObjectsPool_Sharded_Concurrency)
+{
+    constexpr int Threads = 8;
+    constexpr int Iterations = 20000;
+    constexpr int Count = 6;
+
+    auto pool = ObjectsPool<PooledItem>::createSharded(Count);
+    std::atomic_int errors { 0 };
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < Threads; t++) {
+        threads.emplace_back([&](){
+            for (int i = 0; i < Iterations; i++) {
+                auto obj = pool->take();
+                if (obj->users.fetch_add(1) != 0)
+                    errors++;
+                obj->value++;
+                obj->users.fetch_sub(1);
+            }
+        });
+    }
+
+    for (auto& x : threads)
+        x.join();
+
+    ASSERT_EQ(errors, 0);
+
+    auto batch = pool->tryTakeMany(Count);
+    ASSERT_TRUE(batch);
+
+    int sum = 0;
+    for (size_t i = 0; i < batch->size(); i++)
+        sum += (*batch)[i].value;
+
+    ASSERT_EQ(sum, Threads * Iterations);
+}
+
+TEST(utils_cpp, ObjectsPool_TakeAsync)
+{
+    auto pool = ObjectsPool<PooledItem>::create(1, 7);
+    std::unique_ptr<ObjectAccessor<PooledItem>> received;
+    const auto callback = [&](ObjectAccessor<PooledItem> obj){ received.reset(new ObjectAccessor<PooledItem>(std::move(obj))); };
+
+    // Free object: immediately
+    auto request = pool->takeAsync(callback);
+    ASSERT_TRUE(received);
+    ASSERT_EQ(received->ref().value, 7);
+    ASSERT_FALSE(request.cancel());
+
+    // Empty pool: on return
+    auto first = std::move(received);
+    pool->takeAsync(callback);
+    ASSERT_FALSE(received);
+
+    first.reset();
+    ASSERT_TRUE(received);
+    ASSERT_EQ(pool->stats().inUse, 1);
+
+    // Cancelled
+    auto cancelled = pool->takeAsync([](ObjectAccessor<PooledItem>){ FAIL(); });
+    ASSERT_TRUE(cancelled.cancel());
+    ASSERT_FALSE(cancelled.cancel());
+
+    received.reset();
+    ASSERT_TRUE(pool->tryTake());
+}
+
+TEST(utils_cpp, ObjectsPool_TakeAsync_CallbackThrows)
+{
+    auto pool = ObjectsPool<PooledItem>::create(1, 5);
+    std::unique_ptr<ObjectAccessor<PooledItem>> first(new ObjectAccessor<PooledItem>(pool->take()));
+    std::unique_ptr<ObjectAccessor<PooledItem>> received;
+
+    pool->takeAsync([](ObjectAccessor<PooledItem>){ throw std::runtime_error("Failed"); });
+    pool->takeAsync([&](ObjectAccessor<PooledItem> obj){ received.reset(new ObjectAccessor<PooledItem>(std::move(obj))); });
+
+    // Exception doesn't escape the returning thread, object of the failed request goes to the next one
+    first.reset();
+    ASSERT_TRUE(received);
+    ASSERT_EQ(received->ref().value, 5);
+    ASSERT_EQ(pool->stats().inUse, 1);
+}
+
+TEST(utils_cpp, ObjectsPool_TakeFuture)
+{
+    auto pool = ObjectsPool<PooledItem>::create(1, 3);
+    std::unique_ptr<ObjectAccessor<PooledItem>> first(new ObjectAccessor<PooledItem>(pool->take()));
+
+    auto future = pool->takeFuture();
+    ASSERT_EQ(future.wait_for(std::chrono::milliseconds(10)), std::future_status::timeout);
+
+    std::thread([&](){ first.reset(); }).join();
+    ASSERT_EQ(future.get()->value, 3);
+
+    // Pending requests are dropped together with the pool
+    auto obj = pool->take();
+    auto dropped = pool->takeFuture();
+    pool.reset();
+    ASSERT_THROW(dropped.get(), std::future_error);
+}
+
+TEST(utils_cpp, ObjectsPool_TakeAsync_ReleasedInCallback)
+{
+    ObjectsPoolOptions options;
+    options.recycleMode = ObjectsPoolRecycleMode::Deferred;
+    options.recycleBatchSize = 1;
+
+    auto pool = ObjectsPool<PooledItem>::create(options, 1);
+    auto token = std::make_shared<int>(0);
+    const std::weak_ptr<int> alive = token;
+    pool->setRecycleHooks(nullptr, [token](PooledItem&){});
+    token.reset();
+
+    std::unique_ptr<ObjectAccessor<PooledItem>> obj(new ObjectAccessor<PooledItem>(pool->take()));
+    std::promise<void> started;
+    std::promise<void> proceed;
+    auto proceedFuture = proceed.get_future().share();
+
+    pool->takeAsync([&, proceedFuture](ObjectAccessor<PooledItem>){
+        started.set_value();
+        proceedFuture.wait();
+    });
+
+    // Callback runs on the cleaner thread and releases the last object of the orphaned pool
+    obj.reset();
+    started.get_future().wait();
+    pool.reset();
+    proceed.set_value();
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!alive.expired() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    ASSERT_TRUE(alive.expired());
+}
+
+TEST(utils_cpp, ObjectsPool_TakeAsync_Concurrency)
+{
+    constexpr int Threads = 4;
+    constexpr int Iterations = 5000;
+
+    auto pool = ObjectsPool<PooledItem>::create(2);
+    std::atomic_int completed { 0 };
+    std::atomic_int cancelled { 0 };
+    std::atomic_int errors { 0 };
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < Threads; t++) {
+        threads.emplace_back([&, t](){
+            for (int i = 0; i < Iterations; i++) {
+                auto request = pool->takeAsync([&](ObjectAccessor<PooledItem> obj){
+                    if (obj->users.fetch_add(1) != 0)
+                        errors++;
+                    obj->users.fetch_sub(1);
+                    completed++;
+                });
+
+                if ((i + t) % 3 == 0 && request.cancel())
+                    cancelled++;
+
+                if (i % 2 == 0)
+                    auto obj = pool->take();
+            }
+        });
+    }
+
+    for (auto& x : threads)
+        x.join();
+
+    ASSERT_EQ(errors, 0);
+    ASSERT_EQ(completed + cancelled, Threads * Iterations);
+    ASSERT_TRUE(pool->tryTakeMany(2));
+}
+
+namespace {
+
+struct SlowItem
+{
+    static std::atomic_int constructing;
+    static std::atomic_int maxConstructing;
+    static std::atomic_int constructed;
+
+    SlowItem(int failAt) {
+        const auto current = ++constructing;
+        auto prevMax = maxConstructing.load();
+        while (current > prevMax && !maxConstructing.compare_exchange_weak(prevMax, current)) { }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        constructing--;
+
+        if (constructed++ == failAt)
+            throw std::runtime_error("Construction failed");
+    }
+};
+
+std::atomic_int SlowItem::constructing { 0 };
+std::atomic_int SlowItem::maxConstructing { 0 };
+std::atomic_int SlowItem::constructed { 0 };
+
+} // namespace
+
+TEST(utils_cpp, ObjectsPool_Parallel)
+{
+    SlowItem::maxConstructing = 0;
+    SlowItem::constructed = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    auto pool = ObjectsPool<SlowItem>::createParallel(8, 4, -1);
+
+    // Available as soon as the first object is ready
+    auto obj = pool->take();
+
+    pool->waitForParallelAppends();
+    ASSERT_EQ(pool->size(), 8);
+    ASSERT_GT(SlowItem::maxConstructing, 1);
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(8 * 20));
+}
+
+TEST(utils_cpp, ObjectsPool_Parallel_TakeMany)
+{
+    SlowItem::constructed = 0;
+
+    // Objects still being constructed count: request waits for them instead of failing
+    auto pool = ObjectsPool<SlowItem>::createParallel(4, 2, -1);
+    auto batch = pool->takeMany(4);
+    ASSERT_EQ(batch.size(), 4);
+    ASSERT_EQ(pool->size(), 4);
+
+    batch.release();
+    ASSERT_FALSE(pool->takeManyUntil(5, std::chrono::steady_clock::now() + std::chrono::milliseconds(10)));
+}
+
+TEST(utils_cpp, ObjectsPool_Parallel_Exception)
+{
+    SlowItem::constructed = 0;
+
+    auto pool = ObjectsPool<SlowItem>::createParallel(4, 2, 1);
+    ASSERT_THROW(pool->waitForParallelAppends(), std::runtime_error);
+    ASSERT_EQ(pool->size(), 3);
+
+    // Error is reported once
+    pool->waitForParallelAppends();
+}
+
+TEST(utils_cpp, ObjectsPool_Parallel_Destroy)
+{
+    SlowItem::constructed = 0;
+
+    auto pool = ObjectsPool<SlowItem>::createParallel(100, 2, -1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    pool.reset();
+
+    ASSERT_LT(SlowItem::constructed, 100);
+}
@@ -0,0 +1,276 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+#include <gtest/gtest.h>
+#include <utils-cpp/keyed_objects_pool.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+struct Connection
+{
+    Connection(const std::string& backend): backend(backend) {}
+
+    std::string backend;
+    std::atomic_int users { 0 };
+};
+
+using Pool = KeyedObjectsPool<std::string, Connection>;
+
+Pool::Factory makeFactory(std::atomic_int* created = nullptr)
+{
+    return [created](const std::string& key){
+        if (created)
+            (*created)++;
+        return std::make_unique<Connection>(key);
+    };
+}
+
+} // namespace
+
+TEST(utils_cpp, KeyedObjectsPool_Basic)
+{
+    std::atomic_int created { 0 };
+    Pool pool({}, makeFactory(&created));
+
+    {
+        auto a = pool.take("a");
+        auto b = pool.take("b");
+        ASSERT_EQ(a->backend, "a");
+        ASSERT_EQ(b->backend, "b");
+        ASSERT_EQ(pool.keys(), 2);
+        ASSERT_EQ(pool.size(), 2);
+    }
+
+    // Reused, also through handle
+    auto a = pool.take("a");
+    ASSERT_EQ(created, 2);
+
+    const auto handle = pool.handle("b");
+    ASSERT_TRUE(handle.isValid());
+    ASSERT_FALSE(Pool::Handle().isValid());
+    ASSERT_EQ(handle.key(), "b");
+    ASSERT_EQ(pool.take(handle)->backend, "b");
+    ASSERT_TRUE(pool.tryTake(handle));
+    ASSERT_TRUE(pool.takeFor(handle, std::chrono::milliseconds(10)));
+    ASSERT_EQ(created, 2);
+    ASSERT_EQ(pool.size("a"), 1);
+    ASSERT_EQ(pool.size("c"), 0);
+}
+
+TEST(utils_cpp, KeyedObjectsPool_PerKeyLimits)
+{
+    KeyedObjectsPoolOptions options;
+    options.maxPerKey = 2;
+    Pool pool(options, makeFactory());
+    pool.setKeyLimits("big", 1, 3);
+
+    auto a1 = pool.take("a");
+    auto a2 = pool.take("a");
+    ASSERT_FALSE(pool.tryTake("a"));
+    ASSERT_FALSE(pool.takeFor("a", std::chrono::milliseconds(10)));
+
+    auto big1 = pool.take("big");
+    auto big2 = pool.take("big");
+    auto big3 = pool.take("big");
+    ASSERT_FALSE(pool.tryTake("big"));
+}
+
+TEST(utils_cpp, KeyedObjectsPool_GlobalCap_Lru)
+{
+    KeyedObjectsPoolOptions options;
+    options.maxTotal = 2;
+    Pool pool(options, makeFactory());
+
+    pool.take("cold");
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    pool.take("warm");
+    ASSERT_EQ(pool.size(), 2);
+
+    // Cap reached: free object of the least recently used key is destroyed
+    auto hot = pool.take("hot");
+    ASSERT_EQ(pool.size(), 2);
+    ASSERT_EQ(pool.size("cold"), 0);
+    ASSERT_EQ(pool.size("warm"), 1);
+
+    // Nothing free to evict
+    auto warm = pool.take("warm");
+    ASSERT_FALSE(pool.tryTake("cold"));
+
+    // Coldest key has nothing free: the next one is evicted
+    options.maxTotal = 3;
+    Pool pool2(options, makeFactory());
+
+    auto k1 = pool2.take("k1");
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    pool2.take("k2");
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    pool2.take("k3");
+
+    auto k4 = pool2.take("k4");
+    ASSERT_EQ(pool2.size(), 3);
+    ASSERT_EQ(pool2.size("k1"), 1);
+    ASSERT_EQ(pool2.size("k2"), 0);
+    ASSERT_EQ(pool2.size("k3"), 1);
+}
+
+TEST(utils_cpp, KeyedObjectsPool_WaitForOtherKey)
+{
+    KeyedObjectsPoolOptions options;
+    options.maxTotal = 1;
+    Pool pool(options, makeFactory());
+
+    std::unique_ptr<ObjectAccessor<Connection>> a(new ObjectAccessor<Connection>(pool.take("a")));
+    std::atomic_bool taken { false };
+
+    std::thread thread([&](){
+        auto b = pool.take("b");
+        taken = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    ASSERT_FALSE(taken);
+
+    // Object of "a" is returned, evicted and replaced by object of "b"
+    a.reset();
+    thread.join();
+    ASSERT_TRUE(taken);
+    ASSERT_EQ(pool.size(), 1);
+}
+
+TEST(utils_cpp, KeyedObjectsPool_WaitForOwnKey)
+{
+    KeyedObjectsPoolOptions options;
+    options.maxPerKey = 1;
+    Pool pool(options, makeFactory());
+
+    std::unique_ptr<ObjectAccessor<Connection>> a(new ObjectAccessor<Connection>(pool.take("a")));
+    std::vector<int> order;
+    std::mutex mutex;
+
+    // Takers blocked by limit of "a" are served in arrival order
+    const auto taker = [&](int id){
+        auto object = pool.take("a");
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(id);
+    };
+
+    std::thread first(taker, 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    std::thread second(taker, 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+
+    // Returns of other keys don't concern them
+    for (int i = 0; i < 100; i++)
+        pool.take("b");
+
+    ASSERT_FALSE(pool.takeFor("a", std::chrono::milliseconds(10)));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ASSERT_TRUE(order.empty());
+    }
+
+    a.reset();
+    first.join();
+    second.join();
+    ASSERT_EQ(order, (std::vector<int>{1, 2}));
+    ASSERT_EQ(pool.size("a"), 1);
+}
+
+TEST(utils_cpp, KeyedObjectsPool_EvictionSkipsWaiters)
+{
+    KeyedObjectsPoolOptions options;
+    options.maxTotal = 1;
+    options.maxPerKey = 1;
+    Pool pool(options, makeFactory());
+
+    std::unique_ptr<ObjectAccessor<Connection>> a(new ObjectAccessor<Connection>(pool.take("a")));
+    std::vector<std::string> order;
+    std::mutex mutex;
+
+    const auto taker = [&](const std::string& key){
+        auto object = pool.take(key);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(key);
+    };
+
+    // "a" waits for its own object, "b" for the global cap
+    std::thread waiterA(taker, "a");
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    std::thread waiterB(taker, "b");
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+
+    // Returned object belongs to the waiter of "a", "b" may evict it only after that
+    a.reset();
+    waiterA.join();
+    waiterB.join();
+    ASSERT_EQ(order, (std::vector<std::string>{"a", "b"}));
+    ASSERT_EQ(pool.size(), 1);
+}
+
+TEST(utils_cpp, KeyedObjectsPool_IdleEviction)
+{
+    KeyedObjectsPoolOptions options;
+    options.minPerKey = 1;
+    Pool pool(options, makeFactory());
+
+    {
+        auto a1 = pool.take("a");
+        auto a2 = pool.take("a");
+        auto a3 = pool.take("a");
+    }
+
+    ASSERT_EQ(pool.evictIdle(std::chrono::hours(1)), 0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    ASSERT_EQ(pool.evictIdle(std::chrono::milliseconds(1)), 2);
+    ASSERT_EQ(pool.size("a"), 1);
+    ASSERT_EQ(pool.size(), 1);
+}
+
+TEST(utils_cpp, KeyedObjectsPool_Concurrency)
+{
+    constexpr int Threads = 8;
+    constexpr int Iterations = 5000;
+    const std::vector<std::string> keys {"a", "b", "c", "d"};
+
+    KeyedObjectsPoolOptions options;
+    options.maxTotal = 3;
+    Pool pool(options, makeFactory());
+    std::atomic_int errors { 0 };
+    std::vector<std::thread> threads;
+
+    // Half of threads take through handles
+    std::vector<Pool::Handle> handles;
+    for (const auto& x : keys)
+        handles.push_back(pool.handle(x));
+
+    for (int t = 0; t < Threads; t++) {
+        threads.emplace_back([&, t](){
+            for (int i = 0; i < Iterations; i++) {
+                const auto index = (i + t) % keys.size();
+                const auto& key = keys[index];
+                auto obj = t % 2 ? pool.take(handles[index]) : pool.take(key);
+
+                if (obj->backend != key || obj->users.fetch_add(1) != 0)
+                    errors++;
+                obj->users.fetch_sub(1);
+            }
+        });
+    }
+
+    for (auto& x : threads)
+        x.join();
+
+    ASSERT_EQ(errors, 0);
+    ASSERT_LE(pool.size(), 3);
+}
@@ -0,0 +1,85 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+#include <gtest/gtest.h>
+#include <utils-cpp/spsc_circularbuffer.h>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+
+TEST(utils_cpp, SpscCircularBuffer_Basic)
+{
+    SpscCircularBuffer buf(8);
+    char data[16] = {};
+
+    ASSERT_EQ(buf.capacity(), 8);
+    ASSERT_EQ(SpscCircularBuffer(5).capacity(), 8);
+    ASSERT_EQ(buf.read(data, 4), 0);
+    ASSERT_EQ(buf.write("abcdef", 6), 6);
+    ASSERT_EQ(buf.write("ghijkl", 6), 2);
+    ASSERT_EQ(buf.size(), 8);
+
+    ASSERT_EQ(buf.readRO(data, 3), 3);
+    ASSERT_EQ(memcmp(data, "abc", 3), 0);
+    ASSERT_EQ(buf.read(data, 5, false), 5);
+    ASSERT_EQ(memcmp(data, "abcde", 5), 0);
+    ASSERT_EQ(buf.size(), 8);
+
+    ASSERT_EQ(buf.read(data, 5), 5);
+    ASSERT_EQ(buf.size(), 3);
+
+    // Wrapped
+    ASSERT_EQ(buf.write("mnopq", 5), 5);
+    ASSERT_EQ(buf.read(data, 16), 8);
+    ASSERT_EQ(memcmp(data, "fghmnopq", 8), 0);
+    ASSERT_EQ(buf.size(), 0);
+}
+
+TEST(utils_cpp, SpscCircularBuffer_Threads)
+{
+    constexpr size_t Total = 1024 * 1024;
+    SpscCircularBuffer buf(4093);
+
+    std::thread producer([&](){
+        unsigned char chunk[1000];
+        size_t written = 0;
+
+        while (written < Total) {
+            const auto size = std::min(sizeof(chunk), Total - written);
+            for (size_t i = 0; i < size; i++)
+                chunk[i] = static_cast<unsigned char>((written + i) % 251);
+
+            size_t offset = 0;
+            while (offset < size) {
+                const auto result = buf.write(chunk + offset, size - offset);
+                if (!result)
+                    std::this_thread::yield();
+                offset += result;
+            }
+
+            written += size;
+        }
+    });
+
+    std::vector<unsigned char> chunk(777);
+    size_t received = 0;
+    size_t errors = 0;
+
+    while (received < Total) {
+        const auto size = buf.read(chunk.data(), chunk.size());
+        if (!size)
+            std::this_thread::yield();
+
+        for (size_t i = 0; i < size; i++)
+            if (chunk[i] != static_cast<unsigned char>((received + i) % 251))
+                errors++;
+
+        received += size;
+    }
+
+    producer.join();
+    ASSERT_EQ(errors, 0);
+    ASSERT_EQ(buf.size(), 0);
+}
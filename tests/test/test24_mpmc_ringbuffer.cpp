@@ -0,0 +1,190 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+#include <gtest/gtest.h>
+#include <utils-cpp/mpmc_ringbuffer.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+
+TEST(utils_cpp, MpmcRingBuffer_Basic)
+{
+    MpmcRingBuffer<std::unique_ptr<int>> buf(3);
+    ASSERT_EQ(buf.capacity(), 4);
+    ASSERT_TRUE(buf.empty());
+
+    std::unique_ptr<int> value;
+    ASSERT_FALSE(buf.tryPop(value));
+
+    for (int i = 0; i < 4; i++)
+        ASSERT_TRUE(buf.tryPush(std::make_unique<int>(i)));
+
+    ASSERT_FALSE(buf.tryPush(std::make_unique<int>(4)));
+    ASSERT_EQ(buf.size(), 4);
+
+    // Wrapped
+    for (int lap = 0; lap < 3; lap++) {
+        for (int i = 0; i < 4; i++) {
+            ASSERT_TRUE(buf.tryPop(value));
+            ASSERT_EQ(*value, i);
+            ASSERT_TRUE(buf.tryEmplace(new int(i)));
+        }
+    }
+
+    // Left items are destroyed with the buffer
+    auto counter = std::make_shared<int>(0);
+    {
+        MpmcRingBuffer<std::shared_ptr<int>> other(2);
+        ASSERT_TRUE(other.tryPush(counter));
+        ASSERT_TRUE(other.tryPush(counter));
+        ASSERT_EQ(counter.use_count(), 3);
+    }
+    ASSERT_EQ(counter.use_count(), 1);
+}
+
+TEST(utils_cpp, MpmcRingBuffer_Bulk)
+{
+    MpmcRingBuffer<std::unique_ptr<int>> buf(8);
+
+    std::vector<std::unique_ptr<int>> input;
+    for (int i = 0; i < 10; i++)
+        input.push_back(std::make_unique<int>(i));
+
+    std::vector<std::unique_ptr<int>> output;
+
+    // Zero count: nothing to claim
+    ASSERT_EQ(buf.tryPushBulk(input.begin(), 0), 0);
+    ASSERT_EQ(buf.tryPopBulk(std::back_inserter(output), 0), 0);
+
+    ASSERT_EQ(buf.tryPushBulk(input.begin(), 6), 6);
+    ASSERT_EQ(buf.tryPopBulk(std::back_inserter(output), 0), 0);
+    ASSERT_EQ(buf.tryPushBulk(input.begin() + 6, 4), 2);
+    ASSERT_EQ(buf.tryPushBulk(input.begin() + 8, 2), 0);
+
+    ASSERT_EQ(buf.tryPopBulk(std::back_inserter(output), 5), 5);
+    ASSERT_EQ(buf.tryPushBulk(input.begin() + 8, 2), 2);
+    ASSERT_EQ(buf.tryPopBulk(std::back_inserter(output), 100), 5);
+    ASSERT_EQ(buf.tryPopBulk(std::back_inserter(output), 100), 0);
+
+    ASSERT_EQ(output.size(), 10);
+    for (int i = 0; i < 10; i++)
+        ASSERT_EQ(*output[i], i);
+}
+
+TEST(utils_cpp, MpmcRingBuffer_Exceptions)
+{
+    struct Throwing
+    {
+        Throwing(int value): value(value) { if (value < 0) throw std::runtime_error("Bad value"); }
+        Throwing(Throwing&&) noexcept = default;
+        Throwing& operator=(Throwing&&) noexcept = default;
+        int value;
+    };
+
+    MpmcRingBuffer<Throwing> buf(2);
+    ASSERT_THROW(buf.tryEmplace(-1), std::runtime_error);
+    ASSERT_TRUE(buf.tryEmplace(1));
+    ASSERT_TRUE(buf.tryEmplace(2));
+
+    // Throwing output: the rest of claimed items is dropped, ring keeps working
+    int popped = 0;
+    const auto output = [&](Throwing&&) { if (popped++) throw std::runtime_error("Output failed"); };
+    struct OutputIt
+    {
+        std::function<void(Throwing&&)> f;
+        OutputIt& operator*() { return *this; }
+        OutputIt& operator++() { return *this; }
+        OutputIt& operator=(Throwing&& x) { f(std::move(x)); return *this; }
+    };
+
+    ASSERT_THROW(buf.tryPopBulk(OutputIt{output}, 2), std::runtime_error);
+    ASSERT_TRUE(buf.empty());
+    ASSERT_TRUE(buf.tryEmplace(3));
+
+    Throwing value(0);
+    ASSERT_TRUE(buf.tryPop(value));
+    ASSERT_EQ(value.value, 3);
+}
+
+TEST(utils_cpp, MpmcRingBuffer_Threads)
+{
+    constexpr int Producers = 3;
+    constexpr int Consumers = 3;
+    constexpr int PerProducer = 20000;
+
+    MpmcRingBuffer<int> buf(64);
+    std::vector<std::atomic_int> received(Producers * PerProducer);
+    std::atomic_int consumed { 0 };
+    std::vector<std::thread> threads;
+
+    for (int p = 0; p < Producers; p++) {
+        threads.emplace_back([&, p](){
+            int next = p * PerProducer;
+            const int end = next + PerProducer;
+
+            while (next < end) {
+                // Mix single and bulk pushes
+                if (next % 2) {
+                    if (buf.tryPush(next)) {
+                        next++;
+                    } else {
+                        std::this_thread::yield();
+                    }
+                } else {
+                    int values[5];
+                    const int count = std::min(5, end - next);
+                    for (int i = 0; i < count; i++)
+                        values[i] = next + i;
+
+                    const auto pushed = static_cast<int>(buf.tryPushBulk(values, count));
+                    if (!pushed)
+                        std::this_thread::yield();
+                    next += pushed;
+                }
+            }
+        });
+    }
+
+    for (int c = 0; c < Consumers; c++) {
+        threads.emplace_back([&, c](){
+            std::vector<int> values;
+
+            while (consumed < Producers * PerProducer) {
+                values.clear();
+                int value;
+
+                if (c % 2) {
+                    if (buf.tryPop(value))
+                        values.push_back(value);
+                } else {
+                    buf.tryPopBulk(std::back_inserter(values), 7);
+                }
+
+                if (values.empty())
+                    std::this_thread::yield();
+
+                for (auto x : values)
+                    received[x]++;
+                consumed += static_cast<int>(values.size());
+            }
+        });
+    }
+
+    for (auto& x : threads)
+        x.join();
+
+    int errors = 0;
+    for (const auto& x : received)
+        if (x != 1)
+            errors++;
+
+    ASSERT_EQ(errors, 0);
+    ASSERT_TRUE(buf.empty());
+}
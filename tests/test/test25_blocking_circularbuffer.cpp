@@ -0,0 +1,118 @@
+/* License:  MIT
+ * Source:   https://github.com/ihor-drachuk/utils-cpp
+ * Contact:  ihor-drachuk-libs@pm.me  */
+
+#include <gtest/gtest.h>
+#include <utils-cpp/blocking_circularbuffer.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+
+TEST(utils_cpp, BlockingCircularBuffer_Basic)
+{
+    BlockingCircularBuffer buf(8);
+    char data[16] = {};
+
+    ASSERT_EQ(buf.tryRead(data, 4), 0);
+    ASSERT_EQ(buf.readAtLeast(data, 4, 0), 0); // Nothing to read into: doesn't wait
+    ASSERT_EQ(buf.tryWrite("abcdef", 6), 6);
+    ASSERT_EQ(buf.writeAllFor("ghijk", 5, std::chrono::milliseconds(10)), 2);
+    ASSERT_EQ(buf.size(), 8);
+
+    ASSERT_EQ(buf.readAtLeast(data, 3, 3), 3);
+    ASSERT_EQ(memcmp(data, "abc", 3), 0);
+
+    // Not enough data: timeout returns what's available
+    ASSERT_EQ(buf.readAtLeastFor(data, 8, 16, std::chrono::milliseconds(10)), 5);
+    ASSERT_EQ(memcmp(data, "defgh", 5), 0);
+    ASSERT_EQ(buf.readAtLeastFor(data, 1, 16, std::chrono::milliseconds(10)), 0);
+
+    // Close: rest of data, then EOF
+    ASSERT_EQ(buf.writeAll("xyz", 3), 3);
+    buf.close();
+    ASSERT_TRUE(buf.isClosed());
+    ASSERT_EQ(buf.tryWrite("a", 1), 0);
+    ASSERT_EQ(buf.writeAll("a", 1), 0);
+    ASSERT_EQ(buf.readAtLeast(data, 8, 16), 3);
+    ASSERT_EQ(buf.readAtLeast(data, 8, 16), 0);
+}
+
+TEST(utils_cpp, BlockingCircularBuffer_Wakeups)
+{
+    BlockingCircularBuffer buf(16);
+    std::atomic_int received { 0 };
+    char data[16] = {};
+
+    std::thread reader([&](){
+        received = static_cast<int>(buf.readAtLeast(data, 6, 16));
+    });
+
+    // Reader isn't satisfied until 6 bytes are there
+    ASSERT_EQ(buf.writeAll("abc", 3), 3);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    ASSERT_EQ(received, 0);
+
+    ASSERT_EQ(buf.writeAll("def", 3), 3);
+    reader.join();
+    ASSERT_EQ(received, 6);
+    ASSERT_EQ(memcmp(data, "abcdef", 6), 0);
+
+    // Blocked writer is released by close
+    ASSERT_EQ(buf.writeAll("0123456789abcdef", 16), 16);
+    std::atomic_int written { -1 };
+
+    std::thread writer([&](){
+        written = static_cast<int>(buf.writeAll("xyz", 3));
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    ASSERT_EQ(written, -1);
+    buf.close();
+    writer.join();
+    ASSERT_EQ(written, 0);
+}
+
+TEST(utils_cpp, BlockingCircularBuffer_Threads)
+{
+    constexpr size_t Total = 256 * 1024;
+    BlockingCircularBuffer buf(1021);
+
+    std::thread producer([&](){
+        unsigned char chunk[700];
+        size_t written = 0;
+
+        while (written < Total) {
+            const auto size = std::min(sizeof(chunk), Total - written);
+            for (size_t i = 0; i < size; i++)
+                chunk[i] = static_cast<unsigned char>((written + i) % 251);
+
+            written += buf.writeAll(chunk, size);
+        }
+
+        buf.close();
+    });
+
+    std::vector<unsigned char> chunk(500);
+    size_t received = 0;
+    size_t errors = 0;
+
+    for (;;) {
+        const auto size = buf.readAtLeast(chunk.data(), 100, chunk.size());
+        if (!size)
+            break;
+
+        for (size_t i = 0; i < size; i++)
+            if (chunk[i] != static_cast<unsigned char>((received + i) % 251))
+                errors++;
+
+        received += size;
+    }
+
+    producer.join();
+    ASSERT_EQ(received, Total);
+    ASSERT_EQ(errors, 0);
+}